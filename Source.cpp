@@ -1,6 +1,7 @@
 ﻿#include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
+#include "image_loader.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
@@ -9,18 +10,168 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "shader.h"
+#include "shader_manager.h"
+#include "profiler.h"
+#include "bench.h"
+#include "job_system.h"
+#include "frame_arena.h"
+#include "mesh.h"
+#include "mesh_optimizer.h"
+#include "scene.h"
+#include "shadow_maps.h"
+#include "gbuffer.h"
+#include "render_queue.h"
+#include "gl_state.h"
+#include "tournament.h"
 #include "camera.h"
+#include "triple_buffer.h"
 
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <new>
+#include <thread>
 
 #define PI 3.14159265
 
-void LoadModel(std::vector<float>& vertices, std::vector<short>& indices, unsigned int& VBO, unsigned int& VBO2, unsigned int& VAO);
-void OutlineModel(std::vector<float>& vertices, std::vector<short>& indices);
+// every C++ heap allocation goes through here so HeapAllocations (frame_arena.h) can count the engine's own. All
+// forms are replaced, arrays, nothrow and the sized deletes included, so whatever one of them allocates is freed
+// by one of them; built as C++17 the over-aligned forms are too
+static void* CountedAllocate(size_t size)
+{
+	HeapAllocations::Record();
+	return malloc(size > 0 ? size : 1);
+}
+void* operator new(size_t size)
+{
+	void* block = CountedAllocate(size);
+	if (block == NULL)
+		throw std::bad_alloc();
+	return block;
+}
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	return CountedAllocate(size);
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	return CountedAllocate(size);
+}
+void operator delete(void* block) noexcept
+{
+	free(block);
+}
+void operator delete[](void* block) noexcept
+{
+	free(block);
+}
+void operator delete(void* block, size_t) noexcept
+{
+	free(block);
+}
+void operator delete[](void* block, size_t) noexcept
+{
+	free(block);
+}
+void operator delete(void* block, const std::nothrow_t&) noexcept
+{
+	free(block);
+}
+void operator delete[](void* block, const std::nothrow_t&) noexcept
+{
+	free(block);
+}
+#ifdef __cpp_aligned_new
+static void* CountedAllocate(size_t size, std::align_val_t alignment)
+{
+	HeapAllocations::Record();
+	size_t align = (size_t)alignment;
+#ifdef _WIN32
+	return _aligned_malloc(size > 0 ? size : 1, align);
+#else
+	// aligned_alloc only takes whole multiples of the alignment
+	return aligned_alloc(align, size > 0 ? (size + align - 1) / align * align : align);
+#endif
+}
+static void CountedFree(void* block, std::align_val_t)
+{
+#ifdef _WIN32
+	_aligned_free(block);
+#else
+	free(block);
+#endif
+}
+void* operator new(size_t size, std::align_val_t alignment)
+{
+	void* block = CountedAllocate(size, alignment);
+	if (block == NULL)
+		throw std::bad_alloc();
+	return block;
+}
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+	return operator new(size, alignment);
+}
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return CountedAllocate(size, alignment);
+}
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return CountedAllocate(size, alignment);
+}
+void operator delete(void* block, std::align_val_t alignment) noexcept
+{
+	CountedFree(block, alignment);
+}
+void operator delete[](void* block, std::align_val_t alignment) noexcept
+{
+	CountedFree(block, alignment);
+}
+void operator delete(void* block, size_t, std::align_val_t alignment) noexcept
+{
+	CountedFree(block, alignment);
+}
+void operator delete[](void* block, size_t, std::align_val_t alignment) noexcept
+{
+	CountedFree(block, alignment);
+}
+void operator delete(void* block, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	CountedFree(block, alignment);
+}
+void operator delete[](void* block, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	CountedFree(block, alignment);
+}
+#endif
+
+void LoadModel(std::vector<float>& vertices, std::vector<short>& indices, unsigned int& VBO, unsigned int& VBO2, unsigned int& VAO, PositionQuantization& quantization, const char* name);
+void OptimizeMesh(std::vector<float>& vertices, std::vector<short>& indices, size_t vertexBytes, const char* name);
+void OutlineModel(std::vector<float>& vertices, std::vector<short>& indices, int sliceCount = 20);
+void AddLathedLods(Scene& scene, unsigned int mesh, const std::vector<float>& outline, const char* name);
+unsigned int AddLathedMesh(Scene& scene, const std::vector<float>& outline, std::vector<float>& vertices, std::vector<short>& indices, const char* name);
+void BindMeshUniforms(Shader& shader, const SceneMesh& mesh, const SceneLod& lod, GLStateCache& state);
+void DrawShadowCasters(Scene& scene, SceneView& casters, const ShadowView& view, Shader& caster, Shader& patchCaster, unsigned int instanceVBO, JobSystem* jobs, GLStateCache& state, Profiler& profiler);
+void ResolveGBuffer(const GBuffer& gbuffer, Shader& resolve, Shader& volume, Shader& present, int pointLightCount, Profiler& profiler);
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
+void window_refresh_callback(GLFWwindow* window);
 void processInput(GLFWwindow* window);
+struct FrameSnapshot;
+void TakeSnapshot(FrameSnapshot& snapshot);
+struct PointLight;
+float PointLightRange(const PointLight& light);
+void SetLightUniforms(Shader& shader, const std::vector<PointLight>& pointLights, const FrameSnapshot& frame);
+void WaitForRedraw(GLFWwindow* window, ShaderManager& shaders, unsigned int drawnCameraVersion);
 unsigned int loadTexture(const char* path);
 
 // settings
@@ -35,6 +186,74 @@ bool firstMouse = true;
 
 // boolean controls view perspective
 bool defaultView = true;
+// camera flashlight (spot light), toggled with F
+bool flashlight = true;
+// frame-time graph, toggled with G
+bool profilerOverlay = false;
+// render on demand (--on-demand): after a frame the loop sleeps until something asks for the next one
+bool renderOnDemand = false;
+bool redrawRequested = true;
+// longest sleep between two checks while idle, in seconds
+const double IDLE_TIMEOUT = 0.5;
+// size of the default framebuffer, kept up to date by framebuffer_size_callback
+int framebufferWidth = SCR_WIDTH;
+int framebufferHeight = SCR_HEIGHT;
+// input sampling rate of the simulation thread (--threaded), in steps per second
+const double SIMULATION_RATE = 240.0;
+// print the vertex counts and cache statistics of every mesh as it is optimized (--mesh-stats)
+bool meshStats = false;
+// lathe the pieces in the vertex shader from their outlines instead of uploading meshes (--gpu-lathe)
+bool gpuLathe = false;
+// tessellations of a GPU lathed piece; they cost no memory, so there are more of them than on the CPU
+const int GPU_LATHE_SLICES[] = { 8, 12, 16, 20, 24, 32, 48, 64, 96, 128, 192, 256 };
+// draw the lathed pieces as a coarse lathe the tessellation stages refine by screen size (--tessellate, GL 4.0)
+bool tessellate = false;
+// slices of that coarse lathe; the tessellator splits each one up to 64 times
+const int TESSELLATION_BASE_SLICES = 8;
+// percentage-closer filtering taps of the shadow lookups (--shadows [taps]); 0 draws without shadows
+int shadowTaps = 0;
+// texture units of the shadow maps in the lit programs; 0 to 2 are the material maps and the lathe outline
+const int CASCADE_SHADOW_UNIT = 3;
+const int POINT_SHADOW_UNIT = 4;
+// point lights with shadow maps: the scene's own four; the lamps --lights adds are unshadowed
+const int SHADOWED_POINT_LIGHTS = 4;
+// light the G-buffer in screen space instead of every fragment as it is drawn (--deferred), toggled with R
+bool deferredShading = false;
+// draw the opaque surfaces front to back rather than in scene order (--scene-order turns it off), toggled with B
+bool frontToBack = true;
+// lay down the depth of the opaque surfaces in a pass of their own first, so the lit pass only shades what is
+// visible (--depth-prepass), toggled with Z
+bool depthPrepass = false;
+// draw the opaque surfaces as a heat map of how many times each pixel is shaded (--overdraw), toggled with O
+bool overdrawView = false;
+// most point lights --lights can ask for
+const unsigned int MAX_POINT_LIGHTS = 32;
+// first of the texture units the lighting passes read the G-buffer from (one per GBuffer::Target), after the
+// shadow maps
+const int GBUFFER_UNIT = 5;
+// vertex buffer sizes of all meshes before and after welding, for the --mesh-stats summary
+struct MeshStatsTotals
+{
+	unsigned long long verticesBefore, verticesAfter;
+	unsigned long long bytesBefore, bytesAfter;
+};
+MeshStatsTotals meshStatsTotals = {};
+
+// Everything the renderer reads from the simulation side for one frame. Input and the camera produce one
+// snapshot per step; the renderer only ever sees complete snapshots, so in the threaded mode neither side
+// waits for the other. The pieces and lamps don't move yet and stay in the renderer's Scene.
+struct FrameSnapshot
+{
+	CameraState camera;
+	bool flashlight;
+	bool profilerOverlay;
+	bool deferred;
+	bool frontToBack;
+	bool depthPrepass;
+	bool overdraw;
+	int framebufferWidth;
+	int framebufferHeight;
+};
 
 // timing
 float deltaTime = 0.0f;
@@ -42,14 +261,142 @@ float lastFrame = 0.0f;
 
 // lighting
 glm::vec3 lightPos(1.2f, 1.0f, 2.0f);
-
-int main()
+// direction of the directional light, shared by the lit programs and its shadow maps
+const glm::vec3 dirLightDirection(-0.2f, -1.0f, -0.3f);
+// every piece and the board share one shininess
+const float MATERIAL_SHININESS = 32.0f;
+// one element of pointLights[] in the lit programs
+struct PointLight
 {
+	glm::vec3 position;
+	glm::vec3 ambient;
+	glm::vec3 diffuse;
+	glm::vec3 specular;
+	float constant;
+	float linear;
+	float quadratic;
+};
+
+int main(int argc, char** argv)
+{
+	// command line:
+	//   --trace <file>       writes a Chrome trace of every frame on exit
+	//   --bench [frames]     replays a scripted camera path with vsync off and writes frame time statistics as
+	//                        JSON to bench.json
+	//   --bench-out <file>   writes the benchmark JSON to another file
+	//   --boards <n>         tournament view: n boards in a grid, each with its own game
+	//   --on-demand          only redraw after input, a resize or a shader change instead of continuously
+	//   --threaded           samples input and moves the camera on the main thread, renders on a second one
+	//   --bench-jobs         measures job system spawn and steal latency, checks parallel sums and dependency
+	//                        graphs over many rounds, writes JSON to bench_jobs.json (or --bench-out) and exits
+	//   --gpu-lathe          generates the lathed pieces on the GPU from their outlines, at any tessellation
+	//   --tessellate         draws the lathed pieces as a coarse lathe that tessellation shaders refine until
+	//                        its edges are a few pixels long; needs GL 4.0 and is ignored without it. Compare
+	//                        '--bench --tessellate' with '--bench' for tessellated against pre-tessellated meshes
+	//   --shadows [taps]     shadows of the directional light and the point lights from cached shadow maps, which
+	//                        are only drawn again when a piece moves or a light changes. taps is the filtering:
+	//                        4 (default) for a 3x3 tent, 1 for a single bilinear 2x2 lookup
+	//   --lights <n>         point lights, 4 to 32: the scene's four and then small colored lamps over the boards
+	//   --deferred           starts with the deferred renderer, which writes the pieces and the board to a G-buffer
+	//                        and lights it afterwards; R switches between it and forward shading. Compare
+	//                        '--bench --lights n --deferred' with '--bench --lights n' as n grows
+	//   --scene-order        draws the opaque surfaces in scene order instead of front to back; B switches
+	//   --depth-prepass      draws the depth of the opaque surfaces first with a depth-only program, so the lit
+	//                        pass shades every pixel once; Z switches
+	//   --overdraw           shows how many times each pixel is shaded as a heat map; O switches. The benchmark
+	//                        reports the shaded fragments per pixel of each ordering either way
+	//   --mesh-stats         prints the vertex count, buffer size and vertex cache efficiency of every
+	//                        generated mesh before and after optimization and exits
+	const char* tracePath = NULL;
+	const char* benchPath = NULL;
+	int benchFrames = 0;
+	unsigned int boardCount = 1;
+	unsigned int pointLightCount = 4;
+	bool threaded = false;
+	bool benchJobs = false;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+			tracePath = argv[++i];
+		else if (strcmp(argv[i], "--bench") == 0)
+		{
+			benchFrames = 600;
+			if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+				benchFrames = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--bench-out") == 0 && i + 1 < argc)
+			benchPath = argv[++i];
+		else if (strcmp(argv[i], "--boards") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+			boardCount = (unsigned int)atoi(argv[++i]);
+		else if (strcmp(argv[i], "--on-demand") == 0)
+			renderOnDemand = true;
+		else if (strcmp(argv[i], "--threaded") == 0)
+			threaded = true;
+		else if (strcmp(argv[i], "--bench-jobs") == 0)
+			benchJobs = true;
+		else if (strcmp(argv[i], "--gpu-lathe") == 0)
+			gpuLathe = true;
+		else if (strcmp(argv[i], "--tessellate") == 0)
+			tessellate = true;
+		else if (strcmp(argv[i], "--shadows") == 0)
+		{
+			shadowTaps = 4;
+			if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+				shadowTaps = atoi(argv[++i]) == 1 ? 1 : 4;
+		}
+		else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+		{
+			pointLightCount = (unsigned int)atoi(argv[++i]);
+			pointLightCount = pointLightCount < 4 ? 4 : pointLightCount > MAX_POINT_LIGHTS ? MAX_POINT_LIGHTS : pointLightCount;
+		}
+		else if (strcmp(argv[i], "--deferred") == 0)
+			deferredShading = true;
+		else if (strcmp(argv[i], "--scene-order") == 0)
+			frontToBack = false;
+		else if (strcmp(argv[i], "--depth-prepass") == 0)
+			depthPrepass = true;
+		else if (strcmp(argv[i], "--overdraw") == 0)
+			overdrawView = true;
+		else if (strcmp(argv[i], "--mesh-stats") == 0)
+			meshStats = true;
+	}
+	// worker threads for per-frame engine work (culling and LOD selection of large scenes)
+	JobSystem jobs;
+	if (benchJobs)
+	{
+		const char* path = benchPath ? benchPath : JobBenchmark::DEFAULT_PATH;
+		if (!JobBenchmark::Run(jobs, path))
+		{
+			std::cout << "Failed to write benchmark results: " << path << std::endl;
+			return -1;
+		}
+		std::cout << "Benchmark results written to " << path << std::endl;
+		return 0;
+	}
+	TournamentGrid grid(boardCount);
+	bool tournament = boardCount > 1;
+	// look down on the whole grid
+	if (tournament)
+		camera = Camera(glm::vec3(0.0f, grid.Extent() * 0.9f, grid.Extent() * 1.2f), glm::vec3(0.0f, 1.0f, 0.0f), -90.0f, -38.0f);
+	std::unique_ptr<Benchmark> benchmark;
+	if (benchFrames > 0)
+		benchmark.reset(new Benchmark(benchFrames));
+	// a benchmark measures continuous rendering and steps its camera once per rendered frame
+	if (benchmark)
+	{
+		renderOnDemand = false;
+		threaded = false;
+	}
+	// the render thread draws continuously; the simulation thread already idles between input events
+	if (threaded)
+		renderOnDemand = false;
+
 	// glfw: initialize and configure
 	// ------------------------------
 	glfwInit();
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	// tessellation shaders are core in 4.0; everything else runs on 3.3
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, tessellate ? 4 : 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, tessellate ? 0 : 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
 #ifdef __APPLE__
@@ -59,6 +406,14 @@ int main()
 	// glfw window creation
 	// --------------------
 	GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Chess - Kara Allison", NULL, NULL);
+	if (window == NULL && tessellate)
+	{
+		std::cout << "OpenGL 4.0 is not available, drawing without tessellation" << std::endl;
+		tessellate = false;
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Chess - Kara Allison", NULL, NULL);
+	}
 	if (window == NULL)
 	{
 		std::cout << "Failed to create GLFW window" << std::endl;
@@ -67,8 +422,16 @@ int main()
 	}
 	glfwMakeContextCurrent(window);
 	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-	glfwSetCursorPosCallback(window, mouse_callback);
-	glfwSetScrollCallback(window, scroll_callback);
+	// a benchmark run only moves the camera through its script
+	if (!benchmark)
+	{
+		glfwSetCursorPosCallback(window, mouse_callback);
+		glfwSetScrollCallback(window, scroll_callback);
+		glfwSetKeyCallback(window, key_callback);
+		glfwSetWindowRefreshCallback(window, window_refresh_callback);
+	}
+	else
+		glfwSwapInterval(0);
 
 	// tell GLFW to capture our mouse
 	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
@@ -80,15 +443,155 @@ int main()
 		std::cout << "Failed to initialize GLAD" << std::endl;
 		return -1;
 	}
+	// a driver may hand out an older context than asked for
+	if (tessellate && !GLAD_GL_VERSION_4_0)
+	{
+		std::cout << "OpenGL 4.0 is not available, drawing without tessellation" << std::endl;
+		tessellate = false;
+	}
+	if (benchmark)
+	{
+		benchmark->SetLatheMode(tessellate ? "tessellated" : gpuLathe ? "gpu" : "cpu");
+		benchmark->SetRenderer(deferredShading ? "deferred" : "forward", pointLightCount);
+		benchmark->SetDrawOrder(frontToBack ? "front_to_back" : "scene", depthPrepass);
+	}
 
 	// configure global opengl state
 	// -----------------------------
 	glEnable(GL_DEPTH_TEST);
 
+	// camera matrices live in one uniform buffer that every program reads
+	camera.SetViewport(SCR_WIDTH, SCR_HEIGHT);
+	CameraBuffer cameraBuffer;
+	cameraBuffer.Init();
+
 	// build and compile our shader zprogram
 	// ------------------------------------
-	Shader lightingShader("shaderfiles/6.multiple_lights.vs", "shaderfiles/6.multiple_lights.fs");
-	Shader lightCubeShader("shaderfiles/6.light_cube.vs", "shaderfiles/6.light_cube.fs");
+	// every program is submitted at once so the driver can compile them in parallel; until they are ready
+	// everything is drawn with the (tiny, synchronously built) light cube program, in the vertex layout of the
+	// program it stands in for
+	ShaderDefines fallbackLayouts;
+	fallbackLayouts.push_back("PACKED_VERTICES");
+	fallbackLayouts.push_back("INSTANCED");
+	ShaderManager shaders((GLADloadproc)glfwGetProcAddress, "shaderfiles/6.light_cube.vs", "shaderfiles/6.light_cube.fs", fallbackLayouts);
+	// lighting permutations: the renderer picks the smallest one that covers the lights in use
+	ShaderDefines noSpotDefines;
+	noSpotDefines.push_back("NR_POINT_LIGHTS " + std::to_string(pointLightCount));
+	// everything they draw comes from LoadModel, or with --gpu-lathe also from a lathe outline
+	noSpotDefines.push_back("PACKED_VERTICES");
+	if (gpuLathe)
+		noSpotDefines.push_back("GPU_LATHE");
+	// the depth pre-pass and the overdraw view are drawn with the same vertex stages and without shading
+	ShaderDefines depthDefines = noSpotDefines;
+	depthDefines[0] = "NR_POINT_LIGHTS 0";
+	if (tournament)
+		depthDefines.push_back("INSTANCED");
+	ShaderDefines overdrawDefines = depthDefines;
+	overdrawDefines.push_back("OVERDRAW");
+	depthDefines.push_back("DEPTH_ONLY");
+	// and so are the shadow maps, projected by the light
+	ShaderDefines casterDefines = depthDefines;
+	casterDefines.push_back("SHADOW_CASTER");
+	// the board gets a cascade of its own; the tournament view adds one around the middle boards
+	int shadowCascades = tournament ? 2 : 1;
+	ShaderDefines shadowDefines;
+	if (shadowTaps > 0)
+	{
+		shadowDefines.push_back("SHADOWS");
+		shadowDefines.push_back("SHADOW_CASCADES " + std::to_string(shadowCascades));
+		shadowDefines.push_back("SHADOW_PCF_TAPS " + std::to_string(shadowTaps));
+		shadowDefines.push_back("SHADOW_POINT_LIGHTS " + std::to_string(SHADOWED_POINT_LIGHTS));
+	}
+	noSpotDefines.insert(noSpotDefines.end(), shadowDefines.begin(), shadowDefines.end());
+	ShaderDefines spotDefines = noSpotDefines;
+	spotDefines.push_back("SPOT_LIGHT");
+	ShaderHandle lightingProgram = shaders.Submit("shaderfiles/6.multiple_lights.vs", "shaderfiles/6.multiple_lights.fs", spotDefines);
+	ShaderHandle lightingNoSpotProgram = shaders.Submit("shaderfiles/6.multiple_lights.vs", "shaderfiles/6.multiple_lights.fs", noSpotDefines);
+	ShaderHandle lightCubeProgram = shaders.Submit("shaderfiles/6.light_cube.vs", "shaderfiles/6.light_cube.fs");
+	// the tournament view draws every piece type as one instanced batch
+	ShaderHandle instancedLightingProgram = 0, instancedLightingNoSpotProgram = 0;
+	if (tournament)
+	{
+		ShaderDefines instancedSpotDefines = spotDefines;
+		instancedSpotDefines.push_back("INSTANCED");
+		ShaderDefines instancedNoSpotDefines = noSpotDefines;
+		instancedNoSpotDefines.push_back("INSTANCED");
+		instancedLightingProgram = shaders.Submit("shaderfiles/6.multiple_lights.vs", "shaderfiles/6.multiple_lights.fs", instancedSpotDefines);
+		instancedLightingNoSpotProgram = shaders.Submit("shaderfiles/6.multiple_lights.vs", "shaderfiles/6.multiple_lights.fs", instancedNoSpotDefines);
+	}
+	// with --tessellate the lathed pieces have their own vertex and tessellation stages in front of the same
+	// lighting
+	ShaderHandle patchLightingProgram = 0, patchLightingNoSpotProgram = 0;
+	if (tessellate)
+	{
+		ShaderDefines patchSpotDefines = spotDefines;
+		ShaderDefines patchNoSpotDefines = noSpotDefines;
+		if (tournament)
+		{
+			patchSpotDefines.push_back("INSTANCED");
+			patchNoSpotDefines.push_back("INSTANCED");
+		}
+		patchLightingProgram = shaders.Submit("shaderfiles/lathe_patch.vs", "shaderfiles/6.multiple_lights.fs", patchSpotDefines, nullptr,
+			"shaderfiles/lathe_patch.tcs", "shaderfiles/lathe_patch.tes");
+		patchLightingNoSpotProgram = shaders.Submit("shaderfiles/lathe_patch.vs", "shaderfiles/6.multiple_lights.fs", patchNoSpotDefines, nullptr,
+			"shaderfiles/lathe_patch.tcs", "shaderfiles/lathe_patch.tes");
+		// one patch per outline segment and slice of the coarse lathe
+		glPatchParameteri(GL_PATCH_VERTICES, 4);
+	}
+	ShaderHandle casterProgram = 0, patchCasterProgram = 0;
+	if (shadowTaps > 0)
+	{
+		casterProgram = shaders.Submit("shaderfiles/6.multiple_lights.vs", "shaderfiles/6.multiple_lights.fs", casterDefines);
+		if (tessellate)
+			patchCasterProgram = shaders.Submit("shaderfiles/lathe_patch.vs", "shaderfiles/6.multiple_lights.fs", casterDefines, nullptr,
+				"shaderfiles/lathe_patch.tcs", "shaderfiles/lathe_patch.tes");
+	}
+	// the deferred renderer: the same vertex stages write the surfaces to the G-buffer, then a full screen pass
+	// and the point light volumes light it. Always built, R switches to it at any time
+	ShaderDefines gbufferDefines;
+	gbufferDefines.push_back("PACKED_VERTICES");
+	if (gpuLathe)
+		gbufferDefines.push_back("GPU_LATHE");
+	if (tournament)
+		gbufferDefines.push_back("INSTANCED");
+	ShaderHandle gbufferProgram = shaders.Submit("shaderfiles/6.multiple_lights.vs", "shaderfiles/gbuffer.fs", gbufferDefines);
+	ShaderHandle patchGBufferProgram = 0;
+	if (tessellate)
+		patchGBufferProgram = shaders.Submit("shaderfiles/lathe_patch.vs", "shaderfiles/gbuffer.fs", gbufferDefines, nullptr,
+			"shaderfiles/lathe_patch.tcs", "shaderfiles/lathe_patch.tes");
+	ShaderDefines resolveSpotDefines = shadowDefines;
+	resolveSpotDefines.push_back("SPOT_LIGHT");
+	ShaderDefines lightVolumeDefines = shadowDefines;
+	lightVolumeDefines.push_back("NR_POINT_LIGHTS " + std::to_string(pointLightCount));
+	lightVolumeDefines.push_back("LIGHT_VOLUME");
+	ShaderHandle resolveProgram = shaders.Submit("shaderfiles/deferred.vs", "shaderfiles/deferred.fs", resolveSpotDefines);
+	ShaderHandle resolveNoSpotProgram = shaders.Submit("shaderfiles/deferred.vs", "shaderfiles/deferred.fs", shadowDefines);
+	ShaderHandle lightVolumeProgram = shaders.Submit("shaderfiles/deferred.vs", "shaderfiles/deferred.fs", lightVolumeDefines);
+	ShaderDefines presentDefines;
+	presentDefines.push_back("PRESENT");
+	ShaderHandle presentProgram = shaders.Submit("shaderfiles/deferred.vs", "shaderfiles/deferred.fs", presentDefines);
+	// the depth pre-pass and the overdraw view, also always built for Z and O
+	ShaderHandle depthProgram = shaders.Submit("shaderfiles/6.multiple_lights.vs", "shaderfiles/6.multiple_lights.fs", depthDefines);
+	ShaderHandle overdrawProgram = shaders.Submit("shaderfiles/6.multiple_lights.vs", "shaderfiles/6.multiple_lights.fs", overdrawDefines);
+	ShaderHandle patchDepthProgram = 0, patchOverdrawProgram = 0;
+	if (tessellate)
+	{
+		patchDepthProgram = shaders.Submit("shaderfiles/lathe_patch.vs", "shaderfiles/6.multiple_lights.fs", depthDefines, nullptr,
+			"shaderfiles/lathe_patch.tcs", "shaderfiles/lathe_patch.tes");
+		patchOverdrawProgram = shaders.Submit("shaderfiles/lathe_patch.vs", "shaderfiles/6.multiple_lights.fs", overdrawDefines, nullptr,
+			"shaderfiles/lathe_patch.tcs", "shaderfiles/lathe_patch.tes");
+	}
+	// per-section CPU and GPU timings, shown as a graph with G
+	Profiler profiler;
+	profiler.Init(shaders);
+	if (tracePath)
+		profiler.EnableTrace();
+	// edits to anything in shaderfiles/ are rebuilt in the background and swapped in between frames;
+	// a benchmark measures the final programs only
+	if (benchmark)
+		shaders.WaitAll();
+	else
+		shaders.EnableHotReload(window, "shaderfiles");
 
 	// set up vertex data (and buffer(s)) and configure vertex attributes
 	// ------------------------------------------------------------------
@@ -197,6 +700,8 @@ int main()
 	// Create empty vector for indices
 	std::vector<short> bishopIndices;
 	// Generate model from outline
+	// keep the outline for the other levels of detail
+	std::vector<float> bishopOutline = bishopVertices;
 	OutlineModel(bishopVertices, bishopIndices);
 
 	std::vector<float> knightVertices{
@@ -222,6 +727,8 @@ int main()
 	// Create empty vector for indices
 	std::vector<short> knightIndices;
 	// Generate model from outline
+	// keep the outline for the other levels of detail
+	std::vector<float> knightOutline = knightVertices;
 	OutlineModel(knightVertices, knightIndices);
 
 	std::vector<float> knightHeadVertices{
@@ -420,6 +927,8 @@ int main()
 	// Create empty vector for indices
 	std::vector<short> rookIndices;
 	// Generate model from outline
+	// keep the outline for the other levels of detail
+	std::vector<float> rookOutline = rookVertices;
 	OutlineModel(rookVertices, rookIndices);
 
 	std::vector<float> rookTopVertices{
@@ -596,6 +1105,8 @@ int main()
 	// Create empty vector for indices
 	std::vector<short> queenIndices;
 	// Generate model from outline
+	// keep the outline for the other levels of detail
+	std::vector<float> queenOutline = queenVertices;
 	OutlineModel(queenVertices, queenIndices);
 
 	std::vector<float> kingVertices{
@@ -655,6 +1166,8 @@ int main()
 	// Create empty vector for indices
 	std::vector<short> kingIndices;
 	// Generate model from outline
+	// keep the outline for the other levels of detail
+	std::vector<float> kingOutline = kingVertices;
 	OutlineModel(kingVertices, kingIndices);
 
 	std::vector<float> kingCrossVertices{
@@ -810,6 +1323,8 @@ int main()
 	// Create empty vector for indices
 	std::vector<short> pawnIndices;
 	// Generate model from outline
+	// keep the outline for the other levels of detail
+	std::vector<float> pawnOutline = pawnVertices;
 	OutlineModel(pawnVertices, pawnIndices);
 
 	
@@ -934,22 +1449,41 @@ int main()
 		glm::vec3(-0.8625f, 0.0f, -0.8625f),
 		glm::vec3(-1.2075f, 0.0f, -0.8625f)
 	};
-	// positions of the point lights
-	glm::vec3 pointLightPositions[] = {
-		glm::vec3(3.0f,  5.0f,  3.0f),
-		glm::vec3(-3.0f, 1.0f, 3.0f),
-		glm::vec3(3.0f,  1.0f, -3.0f),
-		glm::vec3(-3.0f,  5.0f, -3.0f)
+	// the point lights: two white ones above the board and two dim red ones beside it
+	std::vector<PointLight> pointLights = {
+		{ glm::vec3(3.0f,  5.0f,  3.0f), glm::vec3(0.05f, 0.05f, 0.05f), glm::vec3(0.8f, 0.8f, 0.8f), glm::vec3(1.0f, 1.0f, 1.0f), 1.0f, 0.09f, 0.032f },
+		{ glm::vec3(-3.0f, 1.0f, 3.0f), glm::vec3(0.05f, 0.0f, 0.0f), glm::vec3(0.2f, 0.0f, 0.0f), glm::vec3(1.0f, 1.0f, 1.0f), 1.0f, 0.09f, 0.032f },
+		{ glm::vec3(3.0f,  1.0f, -3.0f), glm::vec3(0.05f, 0.0f, 0.0f), glm::vec3(0.2f, 0.0f, 0.0f), glm::vec3(1.0f, 1.0f, 1.0f), 1.0f, 0.09f, 0.032f },
+		{ glm::vec3(-3.0f,  5.0f, -3.0f), glm::vec3(0.05f, 0.05f, 0.05f), glm::vec3(0.8f, 0.8f, 0.8f), glm::vec3(1.0f, 1.0f, 1.0f), 1.0f, 0.09f, 0.032f }
 	};
-	// first, configure the cube's VAO (and VBO)
-	unsigned int VBO, cubeVAO;
+	// --lights: short range colored lamps above the boards, on a golden angle spiral so any count covers them evenly
+	const glm::vec3 lampColors[] = { glm::vec3(1.0f, 0.6f, 0.3f), glm::vec3(0.3f, 0.6f, 1.0f), glm::vec3(0.4f, 1.0f, 0.4f), glm::vec3(1.0f, 0.4f, 0.8f) };
+	unsigned int lampCount = pointLightCount - (unsigned int)pointLights.size();
+	for (unsigned int i = 0; i < lampCount; i++)
+	{
+		float angle = 2.39996323f * i;
+		float radius = (tournament ? grid.Extent() : 2.0f) * std::sqrt((i + 0.5f) / lampCount);
+		const glm::vec3& color = lampColors[i % 4];
+		PointLight lamp = { glm::vec3(radius * std::cos(angle), 1.5f, radius * std::sin(angle)), glm::vec3(0.0f), color * 0.8f, color, 1.0f, 0.7f, 1.8f };
+		pointLights.push_back(lamp);
+	}
+	// first, configure the cube's VAO (and VBO); welding the 36 corners above leaves 24 distinct vertices
+	std::vector<float> cubeVertices = vertices;
+	std::vector<short> cubeIndices(36);
+	for (int i = 0; i < 36; i++)
+		cubeIndices[i] = (short)i;
+	OptimizeMesh(cubeVertices, cubeIndices, 8 * sizeof(float), "cube");
+	unsigned int VBO, cubeEBO, cubeVAO;
 	glGenVertexArrays(1, &cubeVAO);
 	glGenBuffers(1, &VBO);
+	glGenBuffers(1, &cubeEBO);
 
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() *sizeof(float), &vertices.front(), GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, cubeVertices.size() * sizeof(float), &cubeVertices.front(), GL_STATIC_DRAW);
 
 	glBindVertexArray(cubeVAO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeEBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, cubeIndices.size() * sizeof(short), &cubeIndices.front(), GL_STATIC_DRAW);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
@@ -957,42 +1491,24 @@ int main()
 	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
 	glEnableVertexAttribArray(2);
 
-	// configure bishop's VAO and VBO
-	unsigned int bishopVBO = 0, bishopVBO2 = 0, bishopVAO = 0;
-	LoadModel(bishopVertices, bishopIndices, bishopVBO, bishopVBO2, bishopVAO);
-	
-	// configure knight's VAO and VBO
-	unsigned int knightVBO = 0, knightVBO2 = 0, knightVAO = 0;
-	LoadModel(knightVertices, knightIndices, knightVBO, knightVBO2, knightVAO);
-	
+	// configure the VAOs and VBOs of the models that are not lathed; the lathed pieces are loaded by
+	// AddLathedMesh
 	unsigned int knightHeadVBO = 0, knightHeadVBO2 = 0, knightHeadVAO = 0;
-	LoadModel(knightHeadVertices, knightHeadIndices, knightHeadVBO, knightHeadVBO2, knightHeadVAO);
-	
-	// configure rook's VAO and VBO
-	unsigned int rookVBO = 0, rookVBO2 = 0, rookVAO = 0;
-	LoadModel(rookVertices, rookIndices, rookVBO, rookVBO2, rookVAO);
-	
+	PositionQuantization knightHeadQuantization;
+	LoadModel(knightHeadVertices, knightHeadIndices, knightHeadVBO, knightHeadVBO2, knightHeadVAO, knightHeadQuantization, "knight head");
+
 	unsigned int rookTopVBO = 0, rookTopVBO2 = 0, rookTopVAO = 0;
-	LoadModel(rookTopVertices, rookTopIndices, rookTopVBO, rookTopVBO2, rookTopVAO);
-	
-	// configure queen's VAO and VBO
-	unsigned int queenVBO = 0, queenVBO2 = 0, queenVAO = 0;
-	LoadModel(queenVertices, queenIndices, queenVBO, queenVBO2, queenVAO);
-	
-	// configure king's VAO and VBO
-	unsigned int kingVBO = 0, kingVBO2 = 0, kingVAO = 0;
-	LoadModel(kingVertices, kingIndices, kingVBO, kingVBO2, kingVAO);
-	
-	unsigned int kingCrossVBO = 0, kingCrossVBO2 = 0, kingCrossVAO = 0;
-	LoadModel(kingCrossVertices, kingCrossIndices, kingCrossVBO, kingCrossVBO2, kingCrossVAO);
+	PositionQuantization rookTopQuantization;
+	LoadModel(rookTopVertices, rookTopIndices, rookTopVBO, rookTopVBO2, rookTopVAO, rookTopQuantization, "rook top");
 
-	// configure pawn's VAO and VBO
-	unsigned int pawnVBO = 0, pawnVBO2 = 0, pawnVAO = 0;
-	LoadModel(pawnVertices, pawnIndices, pawnVBO, pawnVBO2, pawnVAO);
+	unsigned int kingCrossVBO = 0, kingCrossVBO2 = 0, kingCrossVAO = 0;
+	PositionQuantization kingCrossQuantization;
+	LoadModel(kingCrossVertices, kingCrossIndices, kingCrossVBO, kingCrossVBO2, kingCrossVAO, kingCrossQuantization, "king cross");
 
 	// configure plane VAO and VBO
 	unsigned int planeVBO = 0, planeVBO2 = 0, planeVAO = 0;
-	LoadModel(planeVertices, planeIndices, planeVBO, planeVBO2, planeVAO);
+	PositionQuantization planeQuantization;
+	LoadModel(planeVertices, planeIndices, planeVBO, planeVBO2, planeVAO, planeQuantization, "plane");
 
 	// second, configure the light's VAO (VBO stays the same; the vertices are the same for the light object which is also a 3D cube)
 	unsigned int lightCubeVAO;
@@ -1000,6 +1516,7 @@ int main()
 	glBindVertexArray(lightCubeVAO);
 
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeEBO);
 	// note that we update the lamp's position attribute's stride to reflect the updated buffer data
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
 	glEnableVertexAttribArray(0);
@@ -1012,453 +1529,694 @@ int main()
 	unsigned int whiteSpecularMap = loadTexture("whiteMarble_specular.jpg");
 	unsigned int checkerDiffuseMap = loadTexture("checkerMarble.jpg");
 	unsigned int checkerSpecularMap = loadTexture("checkerMarble_specular.jpg");
-
-	// shader configuration
-	// --------------------
-	lightingShader.use();
-	lightingShader.setInt("material.diffuse", 0);
-	lightingShader.setInt("material.specular", 1);
-
-
-	// render loop
-	// -----------
-	while (!glfwWindowShouldClose(window))
+	// indexed by SceneMaterial
+	unsigned int diffuseMaps[] = { blackDiffuseMap, whiteDiffuseMap, checkerDiffuseMap };
+	unsigned int specularMaps[] = { blackSpecularMap, whiteSpecularMap, checkerSpecularMap };
+
+	// the scene as data: one mesh per generated model, one instance per piece; the lathed pieces also get
+	// coarser and finer tessellations, picked per instance by screen size
+	// ------------------------------------------------------------------------------------------------------
+	Scene scene;
+	unsigned int bishopMesh = AddLathedMesh(scene, bishopOutline, bishopVertices, bishopIndices, "bishop");
+	unsigned int knightMesh = AddLathedMesh(scene, knightOutline, knightVertices, knightIndices, "knight");
+	unsigned int knightHeadMesh = scene.AddMesh(knightHeadVAO, knightHeadIndices.size(), true, knightHeadQuantization, knightHeadVertices, 8);
+	unsigned int rookMesh = AddLathedMesh(scene, rookOutline, rookVertices, rookIndices, "rook");
+	unsigned int rookTopMesh = scene.AddMesh(rookTopVAO, rookTopIndices.size(), true, rookTopQuantization, rookTopVertices, 8);
+	unsigned int queenMesh = AddLathedMesh(scene, queenOutline, queenVertices, queenIndices, "queen");
+	unsigned int kingMesh = AddLathedMesh(scene, kingOutline, kingVertices, kingIndices, "king");
+	unsigned int kingCrossMesh = scene.AddMesh(kingCrossVAO, kingCrossIndices.size(), true, kingCrossQuantization, kingCrossVertices, 8);
+	unsigned int pawnMesh = AddLathedMesh(scene, pawnOutline, pawnVertices, pawnIndices, "pawn");
+	unsigned int planeMesh = scene.AddMesh(planeVAO, planeIndices.size(), true, planeQuantization, planeVertices, 8);
+	unsigned int lightCubeMesh = scene.AddMesh(lightCubeVAO, cubeIndices.size(), true, PositionQuantization(), cubeVertices, 8);
+	if (meshStats)
 	{
-		// per-frame time logic
-		// --------------------
-		float currentFrame = glfwGetTime();
-		deltaTime = currentFrame - lastFrame;
-		lastFrame = currentFrame;
-
-		// input
-		// -----
-		processInput(window);
-
-		// render
-		// ------
-		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-		// be sure to activate shader when setting uniforms/drawing objects
-		lightingShader.use();
-		lightingShader.setVec3("viewPos", camera.Position);
-		lightingShader.setFloat("material.shininess", 32.0f);
-
-		/*
-		   Here we set all the uniforms for the 5/6 types of lights we have. We have to set them manually and index
-		   the proper PointLight struct in the array to set each uniform variable. This can be done more code-friendly
-		   by defining light types as classes and set their values in there, or by using a more efficient uniform approach
-		   by using 'Uniform buffer objects', but that is something we'll discuss in the 'Advanced GLSL' tutorial.
-		*/
-		// directional light
-		lightingShader.setVec3("dirLight.direction", -0.2f, -1.0f, -0.3f);
-		lightingShader.setVec3("dirLight.ambient", 0.05f, 0.05f, 0.05f);
-		lightingShader.setVec3("dirLight.diffuse", 0.4f, 0.4f, 0.4f);
-		lightingShader.setVec3("dirLight.specular", 0.5f, 0.5f, 0.5f);
-		// point light 1
-		lightingShader.setVec3("pointLights[0].position", pointLightPositions[0]);
-		lightingShader.setVec3("pointLights[0].ambient", 0.05f, 0.05f, 0.05f);
-		lightingShader.setVec3("pointLights[0].diffuse", 0.8f, 0.8f, 0.8f);
-		lightingShader.setVec3("pointLights[0].specular", 1.0f, 1.0f, 1.0f);
-		lightingShader.setFloat("pointLights[0].constant", 1.0f);
-		lightingShader.setFloat("pointLights[0].linear", 0.09);
-		lightingShader.setFloat("pointLights[0].quadratic", 0.032);
-		// point light 2
-		lightingShader.setVec3("pointLights[1].position", pointLightPositions[1]);
-		lightingShader.setVec3("pointLights[1].ambient", 0.05f, 0.00f, 0.00f);
-		lightingShader.setVec3("pointLights[1].diffuse", 0.2f, 0.0f, 0.0f);
-		lightingShader.setVec3("pointLights[1].specular", 1.0f, 1.0f, 1.0f);
-		lightingShader.setFloat("pointLights[1].constant", 1.0f);
-		lightingShader.setFloat("pointLights[1].linear", 0.09);
-		lightingShader.setFloat("pointLights[1].quadratic", 0.032);
-		// point light 3
-		lightingShader.setVec3("pointLights[2].position", pointLightPositions[2]);
-		lightingShader.setVec3("pointLights[2].ambient", 0.05f, 0.00f, 0.00f);
-		lightingShader.setVec3("pointLights[2].diffuse", 0.2f, 0.0f, 0.0f);
-		lightingShader.setVec3("pointLights[2].specular", 1.0f, 1.0f, 1.0f);
-		lightingShader.setFloat("pointLights[2].constant", 1.0f);
-		lightingShader.setFloat("pointLights[2].linear", 0.09);
-		lightingShader.setFloat("pointLights[2].quadratic", 0.032);
-		// point light 4
-		lightingShader.setVec3("pointLights[3].position", pointLightPositions[3]);
-		lightingShader.setVec3("pointLights[3].ambient", 0.05f, 0.05f, 0.05f);
-		lightingShader.setVec3("pointLights[3].diffuse", 0.8f, 0.8f, 0.8f);
-		lightingShader.setVec3("pointLights[3].specular", 1.0f, 1.0f, 1.0f);
-		lightingShader.setFloat("pointLights[3].constant", 1.0f);
-		lightingShader.setFloat("pointLights[3].linear", 0.09);
-		lightingShader.setFloat("pointLights[3].quadratic", 0.032);
-		// spotLight
-		lightingShader.setVec3("spotLight.position", camera.Position);
-		lightingShader.setVec3("spotLight.direction", camera.Front);
-		lightingShader.setVec3("spotLight.ambient", 0.0f, 0.0f, 0.0f);
-		lightingShader.setVec3("spotLight.diffuse", 1.0f, 1.0f, 1.0f);
-		lightingShader.setVec3("spotLight.specular", 1.0f, 1.0f, 1.0f);
-		lightingShader.setFloat("spotLight.constant", 1.0f);
-		lightingShader.setFloat("spotLight.linear", 0.09);
-		lightingShader.setFloat("spotLight.quadratic", 0.032);
-		lightingShader.setFloat("spotLight.cutOff", glm::cos(glm::radians(12.5f)));
-		lightingShader.setFloat("spotLight.outerCutOff", glm::cos(glm::radians(15.0f)));
-
-		// view/projection transformations
-		//glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-		glm::mat4 projection;
-		if (defaultView == true) {
-			projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-		}
-		else {
-			projection = glm::ortho(-2.0f, 2.0f, -2.0f, 2.0f, 0.1f, 100.0f);
-		}
-		
-		glm::mat4 view = camera.GetViewMatrix();
-		lightingShader.setMat4("projection", projection);
-		lightingShader.setMat4("view", view);
-
-		// world transformation
-		glm::mat4 model = glm::mat4(1.0f);
-		lightingShader.setMat4("model", model);
-
-		
-
-		// bind diffuse map
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, blackDiffuseMap);
-		// bind specular map
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, blackSpecularMap);
-
-		// render black bishops
-		glBindVertexArray(bishopVAO);
-		for (unsigned int i = 0; i < 2; i++)
-		{
-			// calculate the model matrix for each object and pass it to shader before drawing
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, bishopPositions[i]);
-			float angle = 0.0f;
-			model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-			lightingShader.setMat4("model", model);
-			glDrawElements(GL_TRIANGLES, bishopIndices.size(), GL_UNSIGNED_SHORT, NULL);
-		}
-
-		// render black knights
-		glBindVertexArray(knightVAO);
-		for (unsigned int i = 0; i < 2; i++)
-		{
-			// calculate the model matrix for each object and pass it to shader before drawing
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, knightPositions[i]);
-			float angle = 0.0f;
-			model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-			lightingShader.setMat4("model", model);
-			glDrawElements(GL_TRIANGLES, knightIndices.size(), GL_UNSIGNED_SHORT, NULL);
-		}
-
-		// render black knights head
-		glBindVertexArray(knightHeadVAO);
-		for (unsigned int i = 0; i < 2; i++)
-		{
-			// calculate the model matrix for each object and pass it to shader before drawing
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, knightHeadPositions[i]);
-			float angle = 0.0f;
-			model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-			lightingShader.setMat4("model", model);
-			glDrawElements(GL_TRIANGLES, knightHeadIndices.size(), GL_UNSIGNED_SHORT, NULL);
-		}
-
-		// render black rook
-		glBindVertexArray(rookVAO);
-		for (unsigned int i = 0; i < 2; i++)
-		{
-			// calculate the model matrix for each object and pass it to shader before drawing
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, rookPositions[i]);
-			float angle = 0.0f;
-			model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-			lightingShader.setMat4("model", model);
-			glDrawElements(GL_TRIANGLES, rookIndices.size(), GL_UNSIGNED_SHORT, NULL);
-		}
-
-		// render black rook top
-		glBindVertexArray(rookTopVAO);
-		for (unsigned int i = 0; i < 2; i++)
-		{
-			// calculate the model matrix for each object and pass it to shader before drawing
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, rookTopPositions[i]);
-			float angle = 0.0f;
-			model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-			lightingShader.setMat4("model", model);
-			glDrawElements(GL_TRIANGLES, rookTopIndices.size(), GL_UNSIGNED_SHORT, NULL);
-		}
-
-		// render black queen
-		glBindVertexArray(queenVAO);
-		for (unsigned int i = 0; i < 1; i++)
-		{
-			// calculate the model matrix for each object and pass it to shader before drawing
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, queenPositions[i]);
-			float angle = 0.0f;
-			model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-			lightingShader.setMat4("model", model);
-			glDrawElements(GL_TRIANGLES, queenIndices.size(), GL_UNSIGNED_SHORT, NULL);
-		}
-
-		// render black king
-		glBindVertexArray(kingVAO);
-		for (unsigned int i = 0; i < 1; i++)
-		{
-			// calculate the model matrix for each object and pass it to shader before drawing
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, kingPositions[i]);
-			float angle = 0.0f;
-			model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-			lightingShader.setMat4("model", model);
-			glDrawElements(GL_TRIANGLES, kingIndices.size(), GL_UNSIGNED_SHORT, NULL);
-		}
-
-		// render black king cross
-		glBindVertexArray(kingCrossVAO);
-		for (unsigned int i = 0; i < 1; i++)
-		{
-			// calculate the model matrix for each object and pass it to shader before drawing
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, kingCrossPositions[i]);
-			float angle = 0.0f;
-			model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-			lightingShader.setMat4("model", model);
-			glDrawElements(GL_TRIANGLES, kingCrossIndices.size(), GL_UNSIGNED_SHORT, NULL);
-		}
+		printf("%-24s %6llu -> %6llu vertices  %8llu -> %8llu bytes\n", "total", meshStatsTotals.verticesBefore,
+			meshStatsTotals.verticesAfter, meshStatsTotals.bytesBefore, meshStatsTotals.bytesAfter);
+		glfwTerminate();
+		return 0;
+	}
 
-		// render black pawns
-		glBindVertexArray(pawnVAO);
-		for (unsigned int i = 0; i < 8; i++)
+	// every piece type of one side: which mesh, where, and how it is turned
+	struct PieceSet
+	{
+		PieceKind piece;
+		unsigned int mesh;
+		const glm::vec3* positions;
+		unsigned int count;
+		float angle;
+		glm::vec3 axis;
+	};
+	const glm::vec3 noAxis(1.0f, 0.3f, 0.5f);
+	PieceSet blackPieces[] = {
+		{ PIECE_BISHOP, bishopMesh, bishopPositions, 2, 0.0f, noAxis },
+		{ PIECE_KNIGHT, knightMesh, knightPositions, 2, 0.0f, noAxis },
+		{ PIECE_KNIGHT, knightHeadMesh, knightHeadPositions, 2, 0.0f, noAxis },
+		{ PIECE_ROOK, rookMesh, rookPositions, 2, 0.0f, noAxis },
+		{ PIECE_ROOK, rookTopMesh, rookTopPositions, 2, 0.0f, noAxis },
+		{ PIECE_QUEEN, queenMesh, queenPositions, 1, 0.0f, noAxis },
+		{ PIECE_KING, kingMesh, kingPositions, 1, 0.0f, noAxis },
+		{ PIECE_KING, kingCrossMesh, kingCrossPositions, 1, 0.0f, noAxis },
+		{ PIECE_PAWN, pawnMesh, pawnPositions, 8, 0.0f, noAxis }
+	};
+	// the white knights' heads look towards the black side
+	PieceSet whitePieces[] = {
+		{ PIECE_BISHOP, bishopMesh, bishopPositions2, 2, 0.0f, noAxis },
+		{ PIECE_KNIGHT, knightMesh, knightPositions2, 2, 0.0f, noAxis },
+		{ PIECE_KNIGHT, knightHeadMesh, knightHeadPositions2, 2, 180.0f, glm::vec3(0.0f, 1.0f, 0.0f) },
+		{ PIECE_ROOK, rookMesh, rookPositions2, 2, 0.0f, noAxis },
+		{ PIECE_ROOK, rookTopMesh, rookTopPositions2, 2, 0.0f, noAxis },
+		{ PIECE_QUEEN, queenMesh, queenPositions2, 1, 0.0f, noAxis },
+		{ PIECE_KING, kingMesh, kingPositions2, 1, 0.0f, noAxis },
+		{ PIECE_KING, kingCrossMesh, kingCrossPositions2, 1, 0.0f, noAxis },
+		{ PIECE_PAWN, pawnMesh, pawnPositions2, 8, 0.0f, noAxis }
+	};
+	// a single board shows the opening position; in the tournament view every board plays its own game
+	for (unsigned int side = 0; side < 2; side++)
+	{
+		PieceSet* pieces = side == 0 ? blackPieces : whitePieces;
+		for (unsigned int board = 0; board < boardCount; board++)
 		{
-			// calculate the model matrix for each object and pass it to shader before drawing
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, pawnPositions[i]);
-			float angle = 0.0f;
-			model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-			lightingShader.setMat4("model", model);
-			glDrawElements(GL_TRIANGLES, pawnIndices.size(), GL_UNSIGNED_SHORT, NULL);
+			TournamentGame game(board);
+			for (unsigned int p = 0; p < 9; p++)
+			{
+				for (unsigned int i = 0; i < pieces[p].count; i++)
+				{
+					glm::vec3 position = pieces[p].positions[i];
+					if (tournament && !game.Place(side, pieces[p].piece, i, position))
+						continue;
+					glm::mat4 model = glm::mat4(1.0f);
+					model = glm::translate(model, position + grid.BoardOffset(board));
+					model = glm::rotate(model, glm::radians(pieces[p].angle), pieces[p].axis);
+					scene.AddInstance(pieces[p].mesh, side == 0 ? MATERIAL_BLACK : MATERIAL_WHITE, model);
+				}
+			}
 		}
+	}
+	for (unsigned int board = 0; board < boardCount; board++)
+		scene.AddInstance(planeMesh, MATERIAL_CHECKER, glm::rotate(glm::translate(glm::mat4(1.0f), grid.BoardOffset(board)), glm::radians(0.0f), noAxis));
+	// we draw as many light bulbs as we have point lights
+	for (unsigned int i = 0; i < pointLights.size(); i++)
+	{
+		glm::mat4 model = glm::mat4(1.0f);
+		model = glm::translate(model, pointLights[i].position);
+		model = glm::scale(model, glm::vec3(i < 4 ? 0.2f : 0.08f)); // Make it a smaller cube, the extra lamps even smaller
+		scene.AddInstance(lightCubeMesh, MATERIAL_LIGHT, model);
+	}
 
-		// bind diffuse map
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, whiteDiffuseMap);
-		// bind specular map
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, whiteSpecularMap);
+	// per instance model matrices of the tournament view, uploaded every frame
+	unsigned int instanceVBO = 0;
+	if (tournament)
+	{
+		glGenBuffers(1, &instanceVBO);
+		scene.EnableInstancing(instanceVBO);
+	}
 
-		// render white bishops
-		glBindVertexArray(bishopVAO);
-		for (unsigned int i = 0; i < 2; i++)
+	// shadow maps of every light, fit around what the light can shade; their casters are culled and given levels
+	// of detail apart from the camera's
+	ShadowMaps shadowMaps;
+	SceneView casterView;
+	if (shadowTaps > 0)
+	{
+		AABB board = scene.MaterialBounds(MATERIAL_CHECKER);
+		for (int material = MATERIAL_BLACK; material <= MATERIAL_WHITE; material++)
 		{
-			// calculate the model matrix for each object and pass it to shader before drawing
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, bishopPositions2[i]);
-			float angle = 0.0f;
-			model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-			lightingShader.setMat4("model", model);
-			glDrawElements(GL_TRIANGLES, bishopIndices.size(), GL_UNSIGNED_SHORT, NULL);
+			AABB pieces = scene.MaterialBounds((SceneMaterial)material);
+			board.min = glm::min(board.min, pieces.min);
+			board.max = glm::max(board.max, pieces.max);
 		}
-
-		// render white knights
-		glBindVertexArray(knightVAO);
-		for (unsigned int i = 0; i < 2; i++)
+		shadowMaps.Init(shadowCascades, SHADOWED_POINT_LIGHTS);
+		shadowMaps.SetCascadeBounds(shadowCascades - 1, board);
+		if (tournament)
 		{
-			// calculate the model matrix for each object and pass it to shader before drawing
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, knightPositions2[i]);
-			float angle = 0.0f;
-			model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-			lightingShader.setMat4("model", model);
-			glDrawElements(GL_TRIANGLES, knightIndices.size(), GL_UNSIGNED_SHORT, NULL);
+			AABB middle = board;
+			middle.min = glm::vec3(-grid.Extent() * 0.5f, board.min.y, -grid.Extent() * 0.5f);
+			middle.max = glm::vec3(grid.Extent() * 0.5f, board.max.y, grid.Extent() * 0.5f);
+			shadowMaps.SetCascadeBounds(0, middle);
 		}
+	}
 
-		// render white knights head
-		glBindVertexArray(knightHeadVAO);
-		for (unsigned int i = 0; i < 2; i++)
-		{
-			// calculate the model matrix for each object and pass it to shader before drawing
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, knightHeadPositions2[i]);
-			float angle = 180.0f;
-			model = glm::rotate(model, glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
-			lightingShader.setMat4("model", model);
-			glDrawElements(GL_TRIANGLES, knightHeadIndices.size(), GL_UNSIGNED_SHORT, NULL);
-		}
+	// the deferred renderer's targets, created with its first frame; the lights never move, so their volumes
+	// (center and reach) are worked out once
+	GBuffer gbuffer;
+	std::vector<glm::vec4> lightVolumes;
+	for (size_t i = 0; i < pointLights.size(); i++)
+		lightVolumes.push_back(glm::vec4(pointLights[i].position, PointLightRange(pointLights[i])));
 
-		// render white rook
-		glBindVertexArray(rookVAO);
-		for (unsigned int i = 0; i < 2; i++)
-		{
-			// calculate the model matrix for each object and pass it to shader before drawing
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, rookPositions2[i]);
-			float angle = 0.0f;
-			model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-			lightingShader.setMat4("model", model);
-			glDrawElements(GL_TRIANGLES, rookIndices.size(), GL_UNSIGNED_SHORT, NULL);
-		}
+	// the draws of a frame go through a sorted queue, and their binds through a copy of the GL state
+	RenderQueue renderQueue;
+	GLStateCache glState;
 
-		// render white rook top
-		glBindVertexArray(rookTopVAO);
-		for (unsigned int i = 0; i < 2; i++)
+	// render loop
+	// -----------
+	// in the threaded mode input and camera come from the main thread through 'snapshots'; otherwise the loop
+	// samples them itself at the start of every frame and passes them through the same buffer
+	glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+	if (benchmark)
+		benchmark->SetResolution(framebufferWidth, framebufferHeight);
+	TripleBuffer<FrameSnapshot> snapshots;
+	TakeSnapshot(snapshots.Write());
+	snapshots.Publish();
+	int viewportWidth = framebufferWidth, viewportHeight = framebufferHeight;
+	auto renderLoop = [&]()
+	{
+		while (!glfwWindowShouldClose(window) && !(benchmark && benchmark->Done()))
 		{
-			// calculate the model matrix for each object and pass it to shader before drawing
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, rookTopPositions2[i]);
-			float angle = 0.0f;
-			model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-			lightingShader.setMat4("model", model);
-			glDrawElements(GL_TRIANGLES, rookTopIndices.size(), GL_UNSIGNED_SHORT, NULL);
-		}
+			// per-frame time logic
+			// --------------------
+			double frameStart = glfwGetTime();
+			// transient data of this frame comes from the frame arena
+			FrameArena::Local().BeginFrame();
+			if (!threaded)
+			{
+				redrawRequested = false;
+				float currentFrame = frameStart;
+				deltaTime = benchmark ? benchmark->DeltaTime() : currentFrame - lastFrame;
+				lastFrame = currentFrame;
+			}
+			profiler.BeginFrame();
+			// what the frame's counted stages still allocate on the heap, on this thread and the job workers
+			unsigned long long allocationsAtStart = HeapAllocations::Count();
+			glState.ClearCounts();
+
+			// input
+			// -----
+			if (!threaded)
+			{
+				HeapAllocations::Scope counted;
+				if (benchmark)
+					benchmark->Step(camera);
+				else
+					processInput(window);
+				TakeSnapshot(snapshots.Write());
+				snapshots.Publish();
+			}
+			const FrameSnapshot& frame = snapshots.Read();
+			if (frame.framebufferWidth != viewportWidth || frame.framebufferHeight != viewportHeight)
+			{
+				viewportWidth = frame.framebufferWidth;
+				viewportHeight = frame.framebufferHeight;
+				glViewport(0, 0, viewportWidth, viewportHeight);
+			}
 
-		// render white queen
-		glBindVertexArray(queenVAO);
-		for (unsigned int i = 0; i < 1; i++)
-		{
-			// calculate the model matrix for each object and pass it to shader before drawing
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, queenPositions2[i]);
-			float angle = 0.0f;
-			model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-			lightingShader.setMat4("model", model);
-			glDrawElements(GL_TRIANGLES, queenIndices.size(), GL_UNSIGNED_SHORT, NULL);
-		}
+			// shader configuration, redone whenever a program finished compiling or was reloaded
+			// --------------------
+			if (shaders.Poll())
+			{
+				ShaderHandle litPrograms[] = { lightingProgram, lightingNoSpotProgram, instancedLightingProgram, instancedLightingNoSpotProgram };
+				for (unsigned int i = 0; i < (tournament ? 4u : 2u); i++)
+				{
+					shaders.Get(litPrograms[i]).use();
+					shaders.Get(litPrograms[i]).setInt("material.diffuse", 0);
+					shaders.Get(litPrograms[i]).setInt("material.specular", 1);
+					shaders.Get(litPrograms[i]).setInt("latheOutline", 2);
+					shaders.Get(litPrograms[i]).setInt("cascadeShadowMap", CASCADE_SHADOW_UNIT);
+					shaders.Get(litPrograms[i]).setInt("pointShadowMap", POINT_SHADOW_UNIT);
+				}
+				ShaderHandle patchPrograms[] = { patchLightingProgram, patchLightingNoSpotProgram };
+				for (unsigned int i = 0; i < (tessellate ? 2u : 0u); i++)
+				{
+					shaders.Get(patchPrograms[i]).use();
+					shaders.Get(patchPrograms[i]).setInt("material.diffuse", 0);
+					shaders.Get(patchPrograms[i]).setInt("material.specular", 1);
+					shaders.Get(patchPrograms[i]).setInt("latheOutline", 2);
+					shaders.Get(patchPrograms[i]).setInt("cascadeShadowMap", CASCADE_SHADOW_UNIT);
+					shaders.Get(patchPrograms[i]).setInt("pointShadowMap", POINT_SHADOW_UNIT);
+				}
+				if (shadowTaps > 0)
+				{
+					ShaderHandle casterPrograms[] = { casterProgram, patchCasterProgram };
+					for (unsigned int i = 0; i < (tessellate ? 2u : 1u); i++)
+					{
+						shaders.Get(casterPrograms[i]).use();
+						shaders.Get(casterPrograms[i]).setInt("latheOutline", 2);
+					}
+					// a rebuilt caster program may draw differently
+					shadowMaps.Invalidate();
+				}
+				ShaderHandle gbufferPrograms[] = { gbufferProgram, patchGBufferProgram };
+				for (unsigned int i = 0; i < (tessellate ? 2u : 1u); i++)
+				{
+					shaders.Get(gbufferPrograms[i]).use();
+					shaders.Get(gbufferPrograms[i]).setInt("material.diffuse", 0);
+					shaders.Get(gbufferPrograms[i]).setInt("material.specular", 1);
+					shaders.Get(gbufferPrograms[i]).setInt("latheOutline", 2);
+				}
+				ShaderHandle lightingPasses[] = { resolveProgram, resolveNoSpotProgram, lightVolumeProgram, presentProgram };
+				for (unsigned int i = 0; i < 4; i++)
+				{
+					shaders.Get(lightingPasses[i]).use();
+					shaders.Get(lightingPasses[i]).setInt("gbufferAlbedo", GBUFFER_UNIT + GBuffer::ALBEDO);
+					shaders.Get(lightingPasses[i]).setInt("gbufferSpecular", GBUFFER_UNIT + GBuffer::SPECULAR);
+					shaders.Get(lightingPasses[i]).setInt("gbufferNormal", GBUFFER_UNIT + GBuffer::NORMAL);
+					shaders.Get(lightingPasses[i]).setInt("gbufferDepth", GBUFFER_UNIT + GBuffer::DEPTH);
+					shaders.Get(lightingPasses[i]).setInt("cascadeShadowMap", CASCADE_SHADOW_UNIT);
+					shaders.Get(lightingPasses[i]).setInt("pointShadowMap", POINT_SHADOW_UNIT);
+					shaders.Get(lightingPasses[i]).setInt("lightBuffer", GBUFFER_UNIT + GBuffer::LIGHT);
+				}
+				ShaderHandle unshadedPrograms[] = { depthProgram, overdrawProgram, patchDepthProgram, patchOverdrawProgram };
+				for (unsigned int i = 0; i < (tessellate ? 4u : 2u); i++)
+				{
+					shaders.Get(unshadedPrograms[i]).use();
+					shaders.Get(unshadedPrograms[i]).setInt("latheOutline", 2);
+				}
+			}
+			ShaderHandle litProgram = tournament ? (frame.flashlight ? instancedLightingProgram : instancedLightingNoSpotProgram)
+				: (frame.flashlight ? lightingProgram : lightingNoSpotProgram);
+			// unused without --tessellate
+			ShaderHandle patchLitProgram = frame.flashlight ? patchLightingProgram : patchLightingNoSpotProgram;
+			Shader& lightCubeShader = shaders.Get(lightCubeProgram);
+			// the tournament view has thousands of instances; a single board is not worth the handoff
+			JobSystem* sceneJobs = tournament ? &jobs : NULL;
+			// the deferred renderer takes over once its programs are built; its surface programs stand in for the
+			// lit ones, and the lighting passes run between the surfaces and the lamps
+			Shader& resolveShader = shaders.Get(frame.flashlight ? resolveProgram : resolveNoSpotProgram);
+			Shader& lightVolumeShader = shaders.Get(lightVolumeProgram);
+			// the overdraw view stands in for either renderer's surface programs
+			bool overdrawFrame = frame.overdraw && shaders.IsReady(overdrawProgram) && (!tessellate || shaders.IsReady(patchOverdrawProgram));
+			bool deferredFrame = frame.deferred && !overdrawFrame && shaders.IsReady(gbufferProgram) && (!tessellate || shaders.IsReady(patchGBufferProgram))
+				&& shaders.IsReady(frame.flashlight ? resolveProgram : resolveNoSpotProgram) && shaders.IsReady(lightVolumeProgram) && shaders.IsReady(presentProgram);
+			bool prepassFrame = frame.depthPrepass && shaders.IsReady(depthProgram) && (!tessellate || shaders.IsReady(patchDepthProgram));
+			ShaderHandle surfaceProgram = overdrawFrame ? overdrawProgram : deferredFrame ? gbufferProgram : litProgram;
+			ShaderHandle patchSurfaceProgram = overdrawFrame ? patchOverdrawProgram : deferredFrame ? patchGBufferProgram : patchLitProgram;
+			Shader& lightingShader = shaders.Get(litProgram);
+			Shader& patchShader = shaders.Get(patchLitProgram);
+			Shader& surfaceShader = shaders.Get(surfaceProgram);
+			Shader& patchSurfaceShader = shaders.Get(patchSurfaceProgram);
+
+			// shadow maps: only the ones a light change or a moved piece made out of date are drawn, and only
+			// once their programs are built
+			// -----------
+			if (shadowTaps > 0 && shaders.IsReady(casterProgram) && (!tessellate || shaders.IsReady(patchCasterProgram)))
+			{
+				shadowMaps.SetDirectionalLight(dirLightDirection);
+				for (int i = 0; i < SHADOWED_POINT_LIGHTS; i++)
+					shadowMaps.SetPointLight(i, pointLights[i].position);
+				shadowMaps.InstancesMoved(scene.Moves());
+				profiler.BeginSection("shadows");
+				Shader& casterShader = shaders.Get(casterProgram);
+				Shader& patchCasterShader = shaders.Get(patchCasterProgram);
+				// whatever was bound since the last frame went around the cache
+				glState.Reset();
+				int shadowMapsDrawn = shadowMaps.Update([&](const ShadowView& shadowView)
+				{
+					DrawShadowCasters(scene, casterView, shadowView, casterShader, patchCasterShader, instanceVBO, sceneJobs, glState, profiler);
+				});
+				if (shadowMapsDrawn > 0)
+					glViewport(0, 0, viewportWidth, viewportHeight);
+				profiler.EndSection();
+			}
+			scene.ClearMoves();
+
+			// render
+			// ------
+			// the heat map starts from black
+			float clearGrey = overdrawFrame ? 0.0f : 0.1f;
+			glClearColor(clearGrey, clearGrey, clearGrey, 1.0f);
+			if (deferredFrame)
+			{
+				gbuffer.Resize(viewportWidth, viewportHeight);
+				gbuffer.Bind();
+			}
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+			// be sure to activate shader when setting uniforms/drawing objects
+			if (deferredFrame)
+			{
+				// the surfaces only need the material; the lights go to the lighting passes
+				Shader* passes[] = { &resolveShader, &lightVolumeShader };
+				glm::mat4 inverseViewProjection = glm::inverse(frame.camera.viewProjection);
+				for (int i = 0; i < 2; i++)
+				{
+					passes[i]->use();
+					SetLightUniforms(*passes[i], pointLights, frame);
+					passes[i]->setMat4("inverseViewProjection", inverseViewProjection);
+					if (shadowTaps > 0)
+						shadowMaps.SetReceiverUniforms(*passes[i], CASCADE_SHADOW_UNIT, POINT_SHADOW_UNIT);
+				}
+				lightVolumeShader.setVec4Array("lightVolumes", &lightVolumes[0], (int)lightVolumes.size());
+				if (tessellate)
+				{
+					patchSurfaceShader.use();
+					patchSurfaceShader.setFloat("material.shininess", MATERIAL_SHININESS);
+					patchSurfaceShader.setVec2("viewportSize", (float)viewportWidth, (float)viewportHeight);
+				}
+				surfaceShader.use();
+				surfaceShader.setFloat("material.shininess", MATERIAL_SHININESS);
+			}
+			else if (overdrawFrame)
+			{
+				if (tessellate)
+				{
+					patchSurfaceShader.use();
+					patchSurfaceShader.setVec2("viewportSize", (float)viewportWidth, (float)viewportHeight);
+				}
+				surfaceShader.use();
+			}
+			else
+			{
+				if (tessellate)
+				{
+					patchShader.use();
+					SetLightUniforms(patchShader, pointLights, frame);
+					patchShader.setVec2("viewportSize", (float)viewportWidth, (float)viewportHeight);
+				}
+				lightingShader.use();
+				SetLightUniforms(lightingShader, pointLights, frame);
+				if (shadowTaps > 0)
+				{
+					if (tessellate)
+					{
+						patchShader.use();
+						shadowMaps.SetReceiverUniforms(patchShader, CASCADE_SHADOW_UNIT, POINT_SHADOW_UNIT);
+						lightingShader.use();
+					}
+					shadowMaps.SetReceiverUniforms(lightingShader, CASCADE_SHADOW_UNIT, POINT_SHADOW_UNIT);
+				}
+			}
 
-		// render white king
-		glBindVertexArray(kingVAO);
-		for (unsigned int i = 0; i < 1; i++)
-		{
-			// calculate the model matrix for each object and pass it to shader before drawing
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, kingPositions2[i]);
-			float angle = 0.0f;
-			model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-			lightingShader.setMat4("model", model);
-			glDrawElements(GL_TRIANGLES, kingIndices.size(), GL_UNSIGNED_SHORT, NULL);
-		}
+			// view/projection transformations, cached by the camera and uploaded only when they changed
+			cameraBuffer.Publish(frame.camera);
+			const glm::mat4& projection = frame.camera.projection;
+			const glm::mat4& view = frame.camera.view;
+
+			// the CPU side of the frame, from culling to a sorted render queue; it makes no GL calls, so every heap
+			// allocation in it is the engine's own (see HeapAllocations)
+			std::vector<SceneBatch, FrameAllocator<SceneBatch> > batches;
+			std::vector<glm::mat4, FrameAllocator<glm::mat4> > batchTransforms;
+			{
+				HeapAllocations::Scope counted;
+				// drop everything outside the view frustum and sort the rest front to back (or keep scene order)
+				scene.Cull(frame.camera.frustum, sceneJobs);
+				scene.SelectLods(projection, view, (float)viewportHeight, sceneJobs);
+				if (frame.frontToBack)
+					scene.SortFrontToBack(frame.camera.position, frame.camera.front);
+				profiler.CountInstances(scene.Stats().visible, scene.Stats().culled);
+				const std::vector<unsigned int>& drawList = scene.DrawList();
+				// the tournament view draws one instanced batch per material, mesh and level of detail
+				if (tournament)
+					scene.BuildBatches(batches, batchTransforms);
+
+				// every draw goes into the render queue with its sort key. The pre-pass is drawn in draw list order,
+				// the lit pass too when that is front to back; in scene order the lit pass is grouped by program,
+				// material and mesh instead. A batch ranks by the last of its instances in the draw list: after
+				// SortFrontToBack() that is its farthest one, so batches of nearby instances go first and a batch spread
+				// over the whole scene (the boards of the tournament view) after everything in front of it. The lamps
+				// are few and are drawn one by one with the plain light cube program
+				Shader& depthShader = shaders.Get(depthProgram);
+				Shader& patchDepthShader = shaders.Get(patchDepthProgram);
+				renderQueue.Clear();
+				auto submit = [&](RenderPass pass, Shader& shader, SceneMaterial material, unsigned int mesh, unsigned int lod, unsigned int rank,
+					const SceneInstance* instance, const SceneBatch* batch)
+				{
+					RenderCommand command;
+					command.pass = pass;
+					command.shader = &shader;
+					command.material = material;
+					command.mesh = &scene.Mesh(mesh);
+					command.lod = &command.mesh->lods[lod];
+					command.instance = instance;
+					command.batch = batch;
+					unsigned int program = renderQueue.ProgramSlot(&shader);
+					bool depthFirst = pass == PASS_DEPTH || (pass == PASS_OPAQUE && frame.frontToBack);
+					renderQueue.Submit(depthFirst ? RenderQueue::DepthKey(pass, program, material, mesh, lod, rank)
+						: RenderQueue::StateKey(pass, program, material, mesh, lod, rank), command);
+				};
+				// with --tessellate the lathed pieces are patches with programs of their own
+				auto submitSurface = [&](SceneMaterial material, unsigned int mesh, unsigned int lod, unsigned int rank,
+					const SceneInstance* instance, const SceneBatch* batch)
+				{
+					bool patches = scene.Mesh(mesh).primitive == GL_PATCHES;
+					// a piece lathed on the GPU has no vertices the fallback program could read; it waits for its own
+					if (scene.Mesh(mesh).latheOutline && !shaders.IsReady(patches ? patchSurfaceProgram : surfaceProgram))
+						return;
+					if (prepassFrame)
+						submit(PASS_DEPTH, patches ? patchDepthShader : depthShader, material, mesh, lod, rank, instance, batch);
+					submit(PASS_OPAQUE, patches ? patchSurfaceShader : surfaceShader, material, mesh, lod, rank, instance, batch);
+				};
+				for (size_t i = 0; i < batches.size(); i++)
+				{
+					const SceneBatch& batch = batches[i];
+					if (batch.material != MATERIAL_LIGHT)
+						submitSurface(batch.material, batch.mesh, batch.lod, batch.drawOrder, NULL, &batch);
+				}
+				for (size_t i = 0; i < drawList.size(); i++)
+				{
+					const SceneInstance& instance = scene.Instance(drawList[i]);
+					if (instance.material == MATERIAL_LIGHT)
+						submit(PASS_LAMPS, lightCubeShader, instance.material, instance.mesh, scene.LodIndex(instance), (unsigned int)i, &instance, NULL);
+					else if (!tournament)
+						submitSurface(instance.material, instance.mesh, scene.LodIndex(instance), (unsigned int)i, &instance, NULL);
+				}
+				renderQueue.Sort();
+			}
+			// the model matrices of all batches go into the instance buffer in one upload, for the pre-pass and the
+			// lit pass
+			if (tournament)
+			{
+				glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+				glBufferData(GL_ARRAY_BUFFER, batchTransforms.size() * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+				if (!batchTransforms.empty())
+					glBufferSubData(GL_ARRAY_BUFFER, 0, batchTransforms.size() * sizeof(glm::mat4), &batchTransforms.front());
+			}
 
-		// render white king cross
-		glBindVertexArray(kingCrossVAO);
-		for (unsigned int i = 0; i < 1; i++)
-		{
-			// calculate the model matrix for each object and pass it to shader before drawing
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, kingCrossPositions2[i]);
-			float angle = 0.0f;
-			model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-			lightingShader.setMat4("model", model);
-			glDrawElements(GL_TRIANGLES, kingCrossIndices.size(), GL_UNSIGNED_SHORT, NULL);
+			// the backend: runs the commands in key order and leaves out every bind the state cache already has.
+			// Each pass starts and ends once, with draws or without; the fragment count covers the opaque pass,
+			// and the deferred renderer lights the G-buffer at its end, before the lamps
+			const char* materialSections[] = { "black pieces", "white pieces", "plane", "light cubes" };
+			// a material is its own profiler section only while the surfaces come material by material; front to
+			// back mixes them, and so do the two programs of --tessellate
+			bool materialSectioned = !frame.frontToBack && !tessellate;
+			const char* boundSection = NULL;
+			const Shader* uniformShader = NULL;
+			const SceneLod* uniformLod = NULL;
+			int pass = -1;
+			auto advancePass = [&](int next)
+			{
+				while (pass < next)
+				{
+					if (boundSection != NULL)
+					{
+						profiler.EndSection();
+						boundSection = NULL;
+					}
+					if (pass == PASS_DEPTH && prepassFrame)
+					{
+						glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+						// the lit pass only shades fragments at the depth the pre-pass laid down
+						glDepthFunc(GL_LEQUAL);
+					}
+					else if (pass == PASS_OPAQUE)
+					{
+						profiler.EndFragmentCount();
+						if (overdrawFrame)
+							glDisable(GL_BLEND);
+						if (prepassFrame)
+							glDepthFunc(GL_LESS);
+						if (deferredFrame)
+						{
+							ResolveGBuffer(gbuffer, resolveShader, lightVolumeShader, shaders.Get(presentProgram), (int)pointLights.size(), profiler);
+							glState.Reset();
+							uniformShader = NULL;
+						}
+					}
+					pass++;
+					if (pass == PASS_DEPTH && prepassFrame)
+						glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+					else if (pass == PASS_OPAQUE)
+					{
+						profiler.BeginFragmentCount();
+						if (overdrawFrame)
+						{
+							glEnable(GL_BLEND);
+							glBlendFunc(GL_ONE, GL_ONE);
+						}
+					}
+				}
+			};
+			// the uniform setup above bound programs of its own
+			glState.Reset();
+			for (size_t i = 0; i < renderQueue.Size(); i++)
+			{
+				const RenderCommand& command = renderQueue.Sorted(i);
+				advancePass(command.pass);
+				const char* section = command.pass == PASS_DEPTH ? "depth pre-pass" : command.pass == PASS_LAMPS ? "light cubes"
+					: materialSectioned ? materialSections[command.material] : "surfaces";
+				if (section != boundSection)
+				{
+					if (boundSection != NULL)
+						profiler.EndSection();
+					profiler.BeginSection(section);
+					boundSection = section;
+				}
+				Shader& shader = *command.shader;
+				glState.UseProgram(shader);
+				// the depth and light cube programs sample no textures
+				if (command.pass == PASS_OPAQUE)
+				{
+					glState.BindTexture(0, GL_TEXTURE_2D, diffuseMaps[command.material]);
+					glState.BindTexture(1, GL_TEXTURE_2D, specularMaps[command.material]);
+				}
+				glState.BindVertexArray(command.lod->VAO);
+				// mesh uniforms belong to a program, so a switch of either sets them again
+				if (command.pass != PASS_LAMPS && (&shader != uniformShader || command.lod != uniformLod))
+				{
+					BindMeshUniforms(shader, *command.mesh, *command.lod, glState);
+					uniformShader = &shader;
+					uniformLod = command.lod;
+				}
+				if (command.batch)
+					scene.DrawBatch(*command.batch);
+				else
+				{
+					shader.setMat4("model", command.instance->model);
+					scene.Draw(*command.instance);
+				}
+				profiler.CountDrawCall();
+			}
+			advancePass(RENDER_PASSES);
+			profiler.CountBinds(glState.Binds(), glState.SkippedBinds());
+
+			if (frame.profilerOverlay)
+				profiler.DrawOverlay(shaders);
+			int frameDrawCalls = profiler.DrawCalls();
+			int frameAllocations = (int)(HeapAllocations::Count() - allocationsAtStart);
+			profiler.CountAllocations(frameAllocations);
+			profiler.EndFrame();
+
+			// glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
+			// -------------------------------------------------------------------------------
+			glfwSwapBuffers(window);
+			if (renderOnDemand)
+			{
+				WaitForRedraw(window, shaders, frame.camera.version);
+				// movement after an idle stretch is timed from the moment the loop woke up, not from the last frame
+				lastFrame = (float)glfwGetTime();
+			}
+			else if (!threaded)
+				glfwPollEvents();
+			if (benchmark)
+				benchmark->FrameFinished(glfwGetTime() - frameStart, frameDrawCalls, frameAllocations, profiler.LastCompleteFrame().primitives,
+					profiler.LastCompleteFrame().shadedFragments, glState.Binds(), glState.SkippedBinds());
 		}
+	};
 
-		// render white pawns
-		glBindVertexArray(pawnVAO);
-		for (unsigned int i = 0; i < 8; i++)
+	if (threaded)
+	{
+		// the context moves to the render thread; GLFW wants events and key state on the main thread, so input
+		// and the camera stay here and are sampled at a fixed rate (sooner when an event arrives), whatever
+		// the render thread is doing
+		glfwMakeContextCurrent(NULL);
+		std::thread renderThread([&]()
 		{
-			// calculate the model matrix for each object and pass it to shader before drawing
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, pawnPositions2[i]);
-			float angle = 0.0f;
-			model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-			lightingShader.setMat4("model", model);
-			glDrawElements(GL_TRIANGLES, pawnIndices.size(), GL_UNSIGNED_SHORT, NULL);
-		}
-
-		// bind diffuse map
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, checkerDiffuseMap);
-		// bind specular map
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, checkerSpecularMap);
-
-		// render plane
-		glBindVertexArray(planeVAO);
-		float angle = 0.0f;
-		model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-		lightingShader.setMat4("model", model);
-		glDrawElements(GL_TRIANGLES, planeIndices.size(), GL_UNSIGNED_SHORT, NULL);
-
-		// also draw the lamp object(s)
-		lightCubeShader.use();
-		lightCubeShader.setMat4("projection", projection);
-		lightCubeShader.setMat4("view", view);
-
-		// we now draw as many light bulbs as we have point lights.
-		glBindVertexArray(lightCubeVAO);
-		for (unsigned int i = 0; i < 4; i++)
+			glfwMakeContextCurrent(window);
+			jobs.AttachCurrentThread();
+			renderLoop();
+			glfwMakeContextCurrent(NULL);
+		});
+		while (!glfwWindowShouldClose(window))
 		{
-			model = glm::mat4(1.0f);
-			model = glm::translate(model, pointLightPositions[i]);
-			model = glm::scale(model, glm::vec3(0.2f)); // Make it a smaller cube
-			lightCubeShader.setMat4("model", model);
-			glDrawArrays(GL_TRIANGLES, 0, 36);
+			float currentFrame = (float)glfwGetTime();
+			deltaTime = currentFrame - lastFrame;
+			lastFrame = currentFrame;
+			processInput(window);
+			TakeSnapshot(snapshots.Write());
+			snapshots.Publish();
+			glfwWaitEventsTimeout(1.0 / SIMULATION_RATE);
 		}
-
-
-		// glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-		// -------------------------------------------------------------------------------
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		renderThread.join();
+		glfwMakeContextCurrent(window);
 	}
+	else
+		renderLoop();
+
 
 	// optional: de-allocate all resources once they've outlived their purpose:
 	// ------------------------------------------------------------------------
 	glDeleteVertexArrays(1, &cubeVAO);
 	glDeleteVertexArrays(1, &lightCubeVAO);
 	glDeleteBuffers(1, &VBO);
+	shaders.StopHotReload();
+	if (tracePath && !profiler.WriteChromeTrace(tracePath))
+		std::cout << "Failed to write trace: " << tracePath << std::endl;
+	if (benchmark)
+	{
+		const char* path = benchPath ? benchPath : Benchmark::DEFAULT_PATH;
+		if (benchmark->WriteResults(path))
+			std::cout << "Benchmark results written to " << path << std::endl;
+		else
+			std::cout << "Failed to write benchmark results: " << path << std::endl;
+	}
 
 	// glfw: terminate, clearing all previously allocated GLFW resources.
 	// ------------------------------------------------------------------
 	glfwTerminate();
 	return 0;
 }
-/*Loads a model into the buffer*/
-void LoadModel(std::vector<float>& vertices, std::vector<short>& indices, unsigned int& VBO, unsigned int& VBO2, unsigned int& VAO)
+/*Loads a model into the buffer, packed to 16 bytes per vertex (PackedVertex); 'quantization' receives the
+  mesh bounds the lit shaders need to unpack the positions*/
+void LoadModel(std::vector<float>& vertices, std::vector<short>& indices, unsigned int& VBO, unsigned int& VBO2, unsigned int& VAO, PositionQuantization& quantization, const char* name)
 {
+	OptimizeMesh(vertices, indices, sizeof(PackedVertex), name);
+
 	glGenVertexArrays(1, &VAO);
 	glBindVertexArray(VAO);
 
 	glGenBuffers(1, &VBO);
 	glGenBuffers(1, &VBO2);
 
+	std::vector<PackedVertex> packed;
+	quantization = VertexPacker::Pack(vertices, 8, packed);
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices.front(), GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(PackedVertex), &packed.front(), GL_STATIC_DRAW);
 
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, VBO2);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(short), &indices.front(), GL_STATIC_DRAW);
 
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(2);
+	VertexPacker::SetupAttributes();
+}
+/*Welds duplicate vertices of a mesh (8 floats each), then reorders its triangles for the post-transform vertex
+  cache and in clusters against overdraw. 'vertexBytes' is the size of a vertex as uploaded. Prints the vertex
+  count, buffer size and cache efficiency before and after with --mesh-stats*/
+void OptimizeMesh(std::vector<float>& vertices, std::vector<short>& indices, size_t vertexBytes, const char* name) {
+	size_t vertexCountBefore = vertices.size() / 8;
+	float acmrBefore = MeshOptimizer::Acmr(indices, vertexCountBefore);
+	float atvrBefore = MeshOptimizer::Atvr(indices, vertexCountBefore);
+	size_t vertexCount = MeshOptimizer::WeldVertices(vertices, 8, indices);
+	MeshOptimizer::OptimizeVertexCache(indices, vertexCount);
+	MeshOptimizer::OptimizeOverdraw(indices, vertices, 8);
+	if (meshStats) {
+		printf("%-24s %6u -> %6u vertices  %8u -> %8u bytes  %6u triangles  ACMR %.3f -> %.3f  ATVR %.3f -> %.3f\n", name,
+			(unsigned int)vertexCountBefore, (unsigned int)vertexCount, (unsigned int)(vertexCountBefore * vertexBytes),
+			(unsigned int)(vertexCount * vertexBytes), (unsigned int)(indices.size() / 3), acmrBefore,
+			MeshOptimizer::Acmr(indices, vertexCount), atvrBefore, MeshOptimizer::Atvr(indices, vertexCount));
+		meshStatsTotals.verticesBefore += vertexCountBefore;
+		meshStatsTotals.verticesAfter += vertexCount;
+		meshStatsTotals.bytesBefore += vertexCountBefore * vertexBytes;
+		meshStatsTotals.bytesAfter += vertexCount * vertexBytes;
+	}
 }
+
 /*Uses the half outline vertices from a vector to generate a rotated model from the outline
 //Updates the vertices vector and indices vector*/
-void OutlineModel(std::vector<float>& vertices, std::vector<short>& indices) {
+void OutlineModel(std::vector<float>& vertices, std::vector<short>& indices, int sliceCount) {
 	// Capture size of original vector
 	int sizeInitial = vertices.size();
-	// determine number of slices to iterate, higher number = higher quality
-	int sliceCount = 20;
+	// sliceCount is the number of slices to iterate, higher number = higher quality
 	// Adds rotational vertex data to the vector (slice count + 1 used for full rotation).  Iterates original vector for each angle.
 	for (int j = 1; j < sliceCount + 1; j++) {
 		for (int i = 0; i < sizeInitial; i++) {
 			// push the value of the rotated x coordinate
-			vertices.push_back(vertices.at(i) * cos((360 / sliceCount * j) * PI / 180.0));
+			vertices.push_back(vertices.at(i) * cos((360.0 / sliceCount * j) * PI / 180.0));
 			i++;
 			// push the original y value, this doesn't change
 			vertices.push_back(vertices.at(i));
 			i++;
 			// push the value of the rotated z coordinate, calculated from the x value
-			vertices.push_back(vertices.at(i - 2) * sin((360 / sliceCount * j) * PI / 180.0));
+			vertices.push_back(vertices.at(i - 2) * sin((360.0 / sliceCount * j) * PI / 180.0));
 			i++;
-			// push normal values with rotation
+			// push normal values with rotation (x flips over the back half, z over the second half)
 
-			if (j > 5 && j < 15) {
+			if (j * 4 > sliceCount && j * 4 < sliceCount * 3) {
 				vertices.push_back(-1.0f);
 				i++;
 			}
@@ -1468,7 +2226,7 @@ void OutlineModel(std::vector<float>& vertices, std::vector<short>& indices) {
 			}
 			vertices.push_back(vertices.at(i));
 			i++;
-			if (j > 0 && j < 11) {
+			if (j * 2 <= sliceCount) {
 				vertices.push_back(1.0f);
 				i++;
 			}
@@ -1477,7 +2235,7 @@ void OutlineModel(std::vector<float>& vertices, std::vector<short>& indices) {
 				i++;
 			}
 
-			vertices.push_back(vertices.at(i) + 0.05f * j);
+			vertices.push_back(vertices.at(i) + (1.0f / sliceCount) * j);
 			i++;
 			vertices.push_back(vertices.at(i));
 		}
@@ -1501,6 +2259,295 @@ void OutlineModel(std::vector<float>& vertices, std::vector<short>& indices) {
 	}
 }
 
+/*Builds the other levels of detail of a lathed model from its outline and adds them to the scene mesh*/
+void AddLathedLods(Scene& scene, unsigned int mesh, const std::vector<float>& outline, const char* name) {
+	// the 20 slice model is already loaded
+	int lodSlices[] = { 8, 64, 256 };
+	for (int i = 0; i < 3; i++) {
+		std::vector<float> vertices = outline;
+		std::vector<short> indices;
+		OutlineModel(vertices, indices, lodSlices[i]);
+		unsigned int VBO = 0, VBO2 = 0, VAO = 0;
+		PositionQuantization quantization;
+		char lodName[64];
+		snprintf(lodName, sizeof(lodName), "%s (%d slices)", name, lodSlices[i]);
+		LoadModel(vertices, indices, VBO, VBO2, VAO, quantization, lodName);
+		scene.AddLod(mesh, VAO, indices.size(), quantization, lodSlices[i]);
+	}
+}
+
+/*Adds a lathed piece and its levels of detail to the scene. 'vertices' and 'indices' are the outline already
+  expanded to 20 slices by OutlineModel. With --gpu-lathe only the outline is uploaded, one texel per point in a
+  buffer texture, and 6.multiple_lights.vs builds every vertex from gl_VertexID, so the piece costs a few hundred
+  bytes of GPU memory and any slice count is just a different draw count. --tessellate uploads the same texture
+  and draws a coarse lathe of patches that shaderfiles/lathe_patch.* refine by screen size*/
+unsigned int AddLathedMesh(Scene& scene, const std::vector<float>& outline, std::vector<float>& vertices, std::vector<short>& indices, const char* name) {
+	if (!gpuLathe && !tessellate) {
+		unsigned int VBO = 0, VBO2 = 0, VAO = 0;
+		PositionQuantization quantization;
+		LoadModel(vertices, indices, VBO, VBO2, VAO, quantization, name);
+		unsigned int mesh = scene.AddMesh(VAO, indices.size(), true, quantization, vertices, 8, 20);
+		AddLathedLods(scene, mesh, outline, name);
+		return mesh;
+	}
+
+	// x, y, normal y and v of every outline point; the outlines lie in the xy plane with normal x 1 and u 0
+	unsigned int points = (unsigned int)(outline.size() / 8);
+	std::vector<float> texels;
+	texels.reserve(points * 4);
+	for (unsigned int i = 0; i < points; i++) {
+		texels.push_back(outline[i * 8]);
+		texels.push_back(outline[i * 8 + 1]);
+		texels.push_back(outline[i * 8 + 4]);
+		texels.push_back(outline[i * 8 + 7]);
+	}
+	unsigned int buffer = 0, texture = 0;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+	glBufferData(GL_TEXTURE_BUFFER, texels.size() * sizeof(float), &texels.front(), GL_STATIC_DRAW);
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_BUFFER, texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	// the vertices have no attributes, but the core profile still wants a vertex array bound
+	static unsigned int emptyVAO = 0;
+	if (emptyVAO == 0)
+		glGenVertexArrays(1, &emptyVAO);
+
+	GLsizei segments = (GLsizei)points - 1;
+	if (tessellate) {
+		// one patch of four control points per outline segment and slice of a coarse lathe; its only level of
+		// detail is whatever the tessellation stages make of it
+		unsigned int mesh = scene.AddMesh(emptyVAO, 4 * segments * TESSELLATION_BASE_SLICES, false, PositionQuantization(), vertices, 8, TESSELLATION_BASE_SLICES);
+		scene.SetLatheOutline(mesh, texture);
+		scene.SetPrimitive(mesh, GL_PATCHES);
+		if (meshStats)
+			printf("%-24s %6u outline points, %u bytes (tessellated)\n", name, points, (unsigned int)(texels.size() * sizeof(float)));
+		return mesh;
+	}
+	// two triangles per outline segment and slice; the expanded vertices only serve for the bounds
+	unsigned int mesh = scene.AddMesh(emptyVAO, 6 * segments * 20, false, PositionQuantization(), vertices, 8, 20);
+	scene.SetLatheOutline(mesh, texture);
+	for (size_t i = 0; i < sizeof(GPU_LATHE_SLICES) / sizeof(GPU_LATHE_SLICES[0]); i++)
+		if (GPU_LATHE_SLICES[i] != 20)
+			scene.AddLod(mesh, emptyVAO, 6 * segments * GPU_LATHE_SLICES[i], PositionQuantization(), GPU_LATHE_SLICES[i]);
+	if (meshStats)
+		printf("%-24s %6u outline points, %u bytes (GPU lathe)\n", name, points, (unsigned int)(texels.size() * sizeof(float)));
+	return mesh;
+}
+
+/*Sets what the lit shaders need to read the vertices of one tessellation: the position quantization of packed
+  vertices, and with --gpu-lathe or --tessellate the outline and slice count of a lathed piece (0 slices for
+  vertex data)*/
+void BindMeshUniforms(Shader& shader, const SceneMesh& mesh, const SceneLod& lod, GLStateCache& state) {
+	shader.setVec3("positionScale", lod.quantization.scale);
+	shader.setVec3("positionOffset", lod.quantization.offset);
+	if (!gpuLathe && !tessellate)
+		return;
+	shader.setInt("latheSlices", mesh.latheOutline ? (int)lod.slices : 0);
+	if (mesh.latheOutline)
+		state.BindTexture(2, GL_TEXTURE_BUFFER, mesh.latheOutline);
+}
+
+/*Draws the shadow casters into one shadow map: the pieces, culled against the map's frustum and at the level of
+  detail its resolution asks for. The culling and the levels go into 'casters', so the camera's levels of detail
+  and their hysteresis are left alone. The board and the lamps are left out; nothing they could shade lies
+  behind them. With an instance buffer (the tournament view) the pieces go out in instanced batches*/
+void DrawShadowCasters(Scene& scene, SceneView& casters, const ShadowView& view, Shader& caster, Shader& patchCaster, unsigned int instanceVBO, JobSystem* jobs, GLStateCache& state, Profiler& profiler) {
+	{
+		HeapAllocations::Scope counted;
+		scene.Cull(view.frustum, casters, jobs);
+		scene.SelectLods(view.projection, view.view, (float)view.size, casters, jobs);
+	}
+	if (tessellate) {
+		state.UseProgram(patchCaster);
+		patchCaster.setMat4("lightViewProjection", view.viewProjection);
+		// the lathe is refined by its size in the map
+		patchCaster.setVec2("viewportSize", (float)view.size, (float)view.size);
+	}
+	state.UseProgram(caster);
+	caster.setMat4("lightViewProjection", view.viewProjection);
+	if (instanceVBO) {
+		std::vector<SceneBatch, FrameAllocator<SceneBatch> > batches;
+		std::vector<glm::mat4, FrameAllocator<glm::mat4> > transforms;
+		{
+			HeapAllocations::Scope counted;
+			scene.BuildBatches(casters, batches, transforms);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+		glBufferData(GL_ARRAY_BUFFER, transforms.size() * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+		if (!transforms.empty())
+			glBufferSubData(GL_ARRAY_BUFFER, 0, transforms.size() * sizeof(glm::mat4), &transforms.front());
+		for (size_t i = 0; i < batches.size(); i++) {
+			const SceneBatch& batch = batches[i];
+			if (batch.material == MATERIAL_CHECKER || batch.material == MATERIAL_LIGHT)
+				continue;
+			const SceneMesh& mesh = scene.Mesh(batch.mesh);
+			Shader& shader = mesh.primitive == GL_PATCHES ? patchCaster : caster;
+			state.UseProgram(shader);
+			state.BindVertexArray(mesh.lods[batch.lod].VAO);
+			BindMeshUniforms(shader, mesh, mesh.lods[batch.lod], state);
+			scene.DrawBatch(batch);
+			profiler.CountDrawCall();
+		}
+		return;
+	}
+	for (size_t i = 0; i < casters.drawList.size(); i++) {
+		const SceneInstance& instance = scene.Instance(casters.drawList[i]);
+		if (instance.material == MATERIAL_CHECKER || instance.material == MATERIAL_LIGHT)
+			continue;
+		const SceneMesh& mesh = scene.Mesh(instance.mesh);
+		const SceneLod& lod = mesh.lods[casters.lods[i]];
+		Shader& shader = mesh.primitive == GL_PATCHES ? patchCaster : caster;
+		state.UseProgram(shader);
+		state.BindVertexArray(lod.VAO);
+		BindMeshUniforms(shader, mesh, lod, state);
+		shader.setMat4("model", instance.model);
+		scene.Draw(instance, lod);
+		profiler.CountDrawCall();
+	}
+}
+
+/*Lights the G-buffer. The directional light and the flashlight take one full screen pass, which also copies the
+  surface depth; the point lights are added through their volumes, whose back faces only pass where the surface lies
+  in front of them, so each light shades just the pixels within its reach. Depth clamping keeps the back faces
+  beyond the far plane. The sum is copied to the default framebuffer with the depth the lamps are drawn against*/
+void ResolveGBuffer(const GBuffer& gbuffer, Shader& resolve, Shader& volume, Shader& present, int pointLightCount, Profiler& profiler) {
+	profiler.BeginSection("lighting");
+	gbuffer.BindLight();
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	gbuffer.BindTextures(GBUFFER_UNIT);
+	glDepthFunc(GL_ALWAYS);
+	resolve.use();
+	gbuffer.DrawFullScreen();
+	profiler.CountDrawCall();
+
+	glDepthFunc(GL_GEQUAL);
+	glDepthMask(GL_FALSE);
+	glEnable(GL_CULL_FACE);
+	glCullFace(GL_FRONT);
+	glEnable(GL_DEPTH_CLAMP);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+	volume.use();
+	gbuffer.DrawLightVolumes(pointLightCount);
+	profiler.CountDrawCall();
+	glDisable(GL_BLEND);
+	glDisable(GL_DEPTH_CLAMP);
+	glDisable(GL_CULL_FACE);
+	glDepthMask(GL_TRUE);
+
+	// every pixel is written, the background included, so the framebuffer needs no clear
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	gbuffer.BindTexture(GBuffer::LIGHT, GBUFFER_UNIT + GBuffer::LIGHT);
+	glDepthFunc(GL_ALWAYS);
+	present.use();
+	gbuffer.DrawFullScreen();
+	profiler.CountDrawCall();
+	glDepthFunc(GL_LESS);
+	profiler.EndSection();
+}
+
+/*Distance at which the brightest term of a point light has faded to one 8 bit step, the reach of its volume:
+  constant + linear * d + quadratic * d^2 = 256 * brightest*/
+float PointLightRange(const PointLight& light) {
+	glm::vec3 brightest = glm::max(light.ambient, glm::max(light.diffuse, light.specular));
+	float c = light.constant - 256.0f * std::max(brightest.x, std::max(brightest.y, brightest.z));
+	return (-light.linear + std::sqrt(light.linear * light.linear - 4.0f * light.quadratic * c)) / (2.0f * light.quadratic);
+}
+
+/*Sets the material shininess and every light of the lit programs; the spot light only when the flashlight is on,
+  the permutation without it has no such uniform*/
+void SetLightUniforms(Shader& shader, const std::vector<PointLight>& pointLights, const FrameSnapshot& frame) {
+	// the names of pointLights[i], hashed once for the lights in use
+	struct PointLightNames
+	{
+		UniformName position, ambient, diffuse, specular, constant, linear, quadratic;
+
+		explicit PointLightNames(int index) : position(element(index, "position")), ambient(element(index, "ambient")),
+			diffuse(element(index, "diffuse")), specular(element(index, "specular")), constant(element(index, "constant")),
+			linear(element(index, "linear")), quadratic(element(index, "quadratic")) {}
+
+		static std::string element(int index, const char* member)
+		{
+			return "pointLights[" + std::to_string(index) + "]." + member;
+		}
+	};
+	static std::vector<PointLightNames> names;
+	while (names.size() < pointLights.size())
+		names.push_back(PointLightNames((int)names.size()));
+
+	shader.setFloat("material.shininess", MATERIAL_SHININESS);
+
+	/*
+	   Here we set all the uniforms for the 5/6 types of lights we have. We have to set them manually and index
+	   the proper PointLight struct in the array to set each uniform variable. This can be done more code-friendly
+	   by defining light types as classes and set their values in there, or by using a more efficient uniform approach
+	   by using 'Uniform buffer objects', but that is something we'll discuss in the 'Advanced GLSL' tutorial.
+	*/
+	// directional light
+	shader.setVec3("dirLight.direction", dirLightDirection);
+	shader.setVec3("dirLight.ambient", 0.05f, 0.05f, 0.05f);
+	shader.setVec3("dirLight.diffuse", 0.4f, 0.4f, 0.4f);
+	shader.setVec3("dirLight.specular", 0.5f, 0.5f, 0.5f);
+	// point lights
+	for (size_t i = 0; i < pointLights.size(); i++)
+	{
+		shader.setVec3(names[i].position, pointLights[i].position);
+		shader.setVec3(names[i].ambient, pointLights[i].ambient);
+		shader.setVec3(names[i].diffuse, pointLights[i].diffuse);
+		shader.setVec3(names[i].specular, pointLights[i].specular);
+		shader.setFloat(names[i].constant, pointLights[i].constant);
+		shader.setFloat(names[i].linear, pointLights[i].linear);
+		shader.setFloat(names[i].quadratic, pointLights[i].quadratic);
+	}
+	// spotLight, only present in the SPOT_LIGHT permutation
+	if (frame.flashlight)
+	{
+		shader.setVec3("spotLight.position", frame.camera.position);
+		shader.setVec3("spotLight.direction", frame.camera.front);
+		shader.setVec3("spotLight.ambient", 0.0f, 0.0f, 0.0f);
+		shader.setVec3("spotLight.diffuse", 1.0f, 1.0f, 1.0f);
+		shader.setVec3("spotLight.specular", 1.0f, 1.0f, 1.0f);
+		shader.setFloat("spotLight.constant", 1.0f);
+		shader.setFloat("spotLight.linear", 0.09);
+		shader.setFloat("spotLight.quadratic", 0.032);
+		shader.setFloat("spotLight.cutOff", glm::cos(glm::radians(12.5f)));
+		shader.setFloat("spotLight.outerCutOff", glm::cos(glm::radians(15.0f)));
+	}
+}
+
+/*Captures what the renderer needs from input and the camera*/
+void TakeSnapshot(FrameSnapshot& snapshot) {
+	camera.SetOrthographic(!defaultView);
+	snapshot.camera = camera.GetState();
+	snapshot.flashlight = flashlight;
+	snapshot.profilerOverlay = profilerOverlay;
+	snapshot.deferred = deferredShading;
+	snapshot.frontToBack = frontToBack;
+	snapshot.depthPrepass = depthPrepass;
+	snapshot.overdraw = overdrawView;
+	snapshot.framebufferWidth = framebufferWidth;
+	snapshot.framebufferHeight = framebufferHeight;
+}
+
+/*Handles events until the next frame is needed: a key press or release, a resize or exposed window, a camera
+  change from the mouse, a held movement key, the live profiler graph, or a shader that is still compiling or
+  waiting to be swapped in. Sleeps in glfwWaitEventsTimeout in between, so an idle window costs next to nothing*/
+void WaitForRedraw(GLFWwindow* window, ShaderManager& shaders, unsigned int drawnCameraVersion) {
+	const int movementKeys[] = { GLFW_KEY_W, GLFW_KEY_S, GLFW_KEY_A, GLFW_KEY_D, GLFW_KEY_Q, GLFW_KEY_E };
+	glfwPollEvents();
+	while (!glfwWindowShouldClose(window)) {
+		if (redrawRequested || camera.Version() != drawnCameraVersion || profilerOverlay || shaders.Busy())
+			return;
+		for (int i = 0; i < 6; i++)
+			if (glfwGetKey(window, movementKeys[i]) == GLFW_PRESS)
+				return;
+		glfwWaitEventsTimeout(IDLE_TIMEOUT);
+	}
+}
+
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
 // ---------------------------------------------------------------------------------------------------------
 void processInput(GLFWwindow* window)
@@ -1528,6 +2575,62 @@ void processInput(GLFWwindow* window)
 			defaultView = true;
 		}
 	}
+	// toggle the flashlight once per key press
+	static bool flashlightKeyDown = false;
+	if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS) {
+		if (!flashlightKeyDown)
+			flashlight = !flashlight;
+		flashlightKeyDown = true;
+	}
+	else {
+		flashlightKeyDown = false;
+	}
+	// toggle the profiler graph once per key press
+	static bool profilerKeyDown = false;
+	if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS) {
+		if (!profilerKeyDown)
+			profilerOverlay = !profilerOverlay;
+		profilerKeyDown = true;
+	}
+	else {
+		profilerKeyDown = false;
+	}
+	// switch between forward and deferred shading once per key press
+	static bool rendererKeyDown = false;
+	if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) {
+		if (!rendererKeyDown)
+			deferredShading = !deferredShading;
+		rendererKeyDown = true;
+	}
+	else {
+		rendererKeyDown = false;
+	}
+	// switch the draw order, the depth pre-pass and the overdraw view once per key press
+	static bool orderKeyDown = false, prepassKeyDown = false, overdrawKeyDown = false;
+	if (glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS) {
+		if (!orderKeyDown)
+			frontToBack = !frontToBack;
+		orderKeyDown = true;
+	}
+	else {
+		orderKeyDown = false;
+	}
+	if (glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS) {
+		if (!prepassKeyDown)
+			depthPrepass = !depthPrepass;
+		prepassKeyDown = true;
+	}
+	else {
+		prepassKeyDown = false;
+	}
+	if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS) {
+		if (!overdrawKeyDown)
+			overdrawView = !overdrawView;
+		overdrawKeyDown = true;
+	}
+	else {
+		overdrawKeyDown = false;
+	}
 }
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
@@ -1535,8 +2638,12 @@ void processInput(GLFWwindow* window)
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
 	// make sure the viewport matches the new window dimensions; note that width and 
-	// height will be significantly larger than specified on retina displays.
-	glViewport(0, 0, width, height);
+	// height will be significantly larger than specified on retina displays. The renderer picks the new size
+	// up with the next snapshot, so this also works while the context is current on the render thread.
+	framebufferWidth = width;
+	framebufferHeight = height;
+	camera.SetViewport(width, height);
+	redrawRequested = true;
 }
 
 // glfw: whenever the mouse moves, this callback is called
@@ -1566,6 +2673,21 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 	camera.ProcessMouseScroll(yoffset);
 }
 
+// glfw: key presses and releases wake the render-on-demand loop; processInput reacts to them on the next frame
+// -----------------------------------------------------------------------------------------------------------
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+	if (action != GLFW_REPEAT)
+		redrawRequested = true;
+}
+
+// glfw: the window contents were lost (uncovered, restored) and have to be drawn again
+// -------------------------------------------------------------------------------------
+void window_refresh_callback(GLFWwindow* window)
+{
+	redrawRequested = true;
+}
+
 // utility function for loading a 2D texture from file
 // ---------------------------------------------------
 unsigned int loadTexture(char const* path)
@@ -1573,8 +2695,12 @@ unsigned int loadTexture(char const* path)
 	unsigned int textureID;
 	glGenTextures(1, &textureID);
 
+	// decode straight out of the mapped file, the pixels land in the reusable image arena
+	MappedFile file(path);
 	int width, height, nrComponents;
-	unsigned char* data = stbi_load(path, &width, &height, &nrComponents, 0);
+	unsigned char* data = NULL;
+	if (file.IsOpen())
+		data = stbi_load_from_memory(file.Data(), (int)file.Size(), &width, &height, &nrComponents, 0);
 	if (data)
 	{
 		GLenum format;
@@ -1601,6 +2727,8 @@ unsigned int loadTexture(char const* path)
 		std::cout << "Texture failed to load at path: " << path << std::endl;
 		stbi_image_free(data);
 	}
+	// hand the decode memory back to the arena for the next image
+	ImageArena::Get().Reset();
 
 	return textureID;
 }
\ No newline at end of file
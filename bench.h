@@ -0,0 +1,458 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "camera.h"
+#include "job_system.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+// Deterministic benchmark run (--bench). The camera follows a fixed script that is replayed through the same
+// Camera::ProcessKeyboard/ProcessMouseMovement calls the live input uses, every frame advances by a fixed
+// time step, and the run stops after a fixed number of frames. The first few frames only warm up caches and
+// the driver and are not measured.
+class Benchmark
+{
+public:
+	static const int WARMUP_FRAMES = 30;
+	// where --bench writes its results without --bench-out
+	static constexpr const char* DEFAULT_PATH = "bench.json";
+
+	Benchmark(int frameCount) : frameCount(frameCount), frame(0), scriptLength(0), latheMode("cpu"), renderer("forward"), pointLights(0),
+		drawOrder("front_to_back"), depthPrepass(false), pixels(0)
+	{
+		// the second half of the path undoes the first in reverse order, so one loop ends exactly where it
+		// started and any frame count sees the same views
+		addStep(90, false, FORWARD, -1.0f, 0.0f);  // pan left
+		addStep(40, true, FORWARD, 0.0f, 0.0f);    // move in
+		addStep(30, false, FORWARD, 0.0f, -3.0f);  // tilt down
+		addStep(30, true, UP, 0.0f, 0.0f);         // rise
+		addStep(30, true, LEFT, 0.0f, 0.0f);       // strafe along the board
+		addStep(30, true, RIGHT, 0.0f, 0.0f);
+		addStep(30, true, DOWN, 0.0f, 0.0f);
+		addStep(30, false, FORWARD, 0.0f, 3.0f);
+		addStep(40, true, BACKWARD, 0.0f, 0.0f);
+		addStep(90, false, FORWARD, 1.0f, 0.0f);
+		for (size_t i = 0; i < steps.size(); i++)
+			scriptLength += steps[i].frames;
+		frameTimes.reserve(frameCount);
+		drawCalls.reserve(frameCount);
+		allocations.reserve(frameCount);
+		triangles.reserve(frameCount);
+		fragments.reserve(frameCount);
+		binds.reserve(frameCount);
+		skippedBinds.reserve(frameCount);
+	}
+
+	// how the lathed pieces are drawn ("cpu", "gpu" or "tessellated"), so results of different runs can be
+	// told apart
+	void SetLatheMode(const char* mode)
+	{
+		latheMode = mode;
+	}
+
+	// the renderer ("forward" or "deferred") and how many point lights it shades; '--bench --lights n' against
+	// '--bench --lights n --deferred' for a few n shows where deferred shading starts to pay off
+	void SetRenderer(const char* name, int pointLightCount)
+	{
+		renderer = name;
+		pointLights = pointLightCount;
+	}
+
+	// how the opaque draws are ordered ("scene" or "front_to_back") and whether a depth pre-pass goes first;
+	// together with SetResolution the shaded fragments per pixel tell how much overdraw each one saves
+	void SetDrawOrder(const char* order, bool prepass)
+	{
+		drawOrder = order;
+		depthPrepass = prepass;
+	}
+
+	void SetResolution(int width, int height)
+	{
+		pixels = (long long)width * height;
+	}
+
+	// fixed time step, in seconds
+	float DeltaTime() const
+	{
+		return 1.0f / 60.0f;
+	}
+
+	bool Done() const
+	{
+		return frame >= WARMUP_FRAMES + frameCount;
+	}
+
+	// moves the camera for the current frame
+	void Step(Camera &camera)
+	{
+		int position = frame % scriptLength;
+		for (size_t i = 0; i < steps.size(); i++)
+		{
+			if (position >= steps[i].frames)
+			{
+				position -= steps[i].frames;
+				continue;
+			}
+			if (steps[i].move)
+				camera.ProcessKeyboard(steps[i].movement, DeltaTime());
+			if (steps[i].mouseX != 0.0f || steps[i].mouseY != 0.0f)
+				camera.ProcessMouseMovement(steps[i].mouseX, steps[i].mouseY);
+			break;
+		}
+	}
+
+	// records the wall clock time of the finished frame (input to swap), the draw calls it made, the heap
+	// allocations of the engine's own work, the triangles the GPU generated, the fragments it shaded and the binds
+	// the GL state cache made and skipped. Triangle and fragment counts come from queries and belong to a frame
+	// a few frames back (negative while there is none); over a run that evens out
+	void FrameFinished(double seconds, int drawCalls, int allocations, long long triangles, long long shadedFragments, int binds, int skippedBinds)
+	{
+		if (frame >= WARMUP_FRAMES)
+		{
+			frameTimes.push_back(seconds * 1000.0);
+			this->drawCalls.push_back(drawCalls);
+			this->allocations.push_back(allocations);
+			if (triangles >= 0)
+				this->triangles.push_back(triangles);
+			if (shadedFragments >= 0)
+				fragments.push_back(shadedFragments);
+			this->binds.push_back(binds);
+			this->skippedBinds.push_back(skippedBinds);
+		}
+		frame++;
+	}
+
+	// writes the results as JSON to 'path'. Never to stdout, which also carries the program's diagnostics
+	bool WriteResults(const char* path) const
+	{
+		if (frameTimes.empty())
+			return false;
+		std::vector<double> sorted = frameTimes;
+		std::sort(sorted.begin(), sorted.end());
+		double total = 0.0;
+		for (size_t i = 0; i < sorted.size(); i++)
+			total += sorted[i];
+		size_t p99 = (size_t)(0.99 * (sorted.size() - 1) + 0.5);
+		int minDraws = drawCalls[0], maxDraws = drawCalls[0];
+		long long totalDraws = 0;
+		for (size_t i = 0; i < drawCalls.size(); i++)
+		{
+			minDraws = drawCalls[i] < minDraws ? drawCalls[i] : minDraws;
+			maxDraws = drawCalls[i] > maxDraws ? drawCalls[i] : maxDraws;
+			totalDraws += drawCalls[i];
+		}
+		int maxAllocations = 0;
+		long long totalAllocations = 0;
+		for (size_t i = 0; i < allocations.size(); i++)
+		{
+			maxAllocations = allocations[i] > maxAllocations ? allocations[i] : maxAllocations;
+			totalAllocations += allocations[i];
+		}
+		long long maxTriangles = 0;
+		double totalTriangles = 0.0;
+		for (size_t i = 0; i < triangles.size(); i++)
+		{
+			maxTriangles = triangles[i] > maxTriangles ? triangles[i] : maxTriangles;
+			totalTriangles += (double)triangles[i];
+		}
+		double averageTriangles = triangles.empty() ? 0.0 : totalTriangles / triangles.size();
+		long long maxFragments = 0;
+		double totalFragments = 0.0;
+		for (size_t i = 0; i < fragments.size(); i++)
+		{
+			maxFragments = fragments[i] > maxFragments ? fragments[i] : maxFragments;
+			totalFragments += (double)fragments[i];
+		}
+		double averageFragments = fragments.empty() ? 0.0 : totalFragments / fragments.size();
+		int maxBinds = 0;
+		long long totalBinds = 0, totalSkipped = 0;
+		for (size_t i = 0; i < binds.size(); i++)
+		{
+			maxBinds = binds[i] > maxBinds ? binds[i] : maxBinds;
+			totalBinds += binds[i];
+			totalSkipped += skippedBinds[i];
+		}
+
+		FILE* file = fopen(path, "w");
+		if (file == NULL)
+			return false;
+		fprintf(file, "{\n");
+		fprintf(file, "  \"frames\": %d,\n", (int)sorted.size());
+		fprintf(file, "  \"warmup_frames\": %d,\n", WARMUP_FRAMES);
+		fprintf(file, "  \"lathe\": \"%s\",\n", latheMode);
+		fprintf(file, "  \"renderer\": \"%s\",\n", renderer);
+		fprintf(file, "  \"point_lights\": %d,\n", pointLights);
+		fprintf(file, "  \"draw_order\": \"%s\",\n", drawOrder);
+		fprintf(file, "  \"depth_prepass\": %s,\n", depthPrepass ? "true" : "false");
+		fprintf(file, "  \"frame_ms\": { \"min\": %.4f, \"avg\": %.4f, \"p99\": %.4f, \"max\": %.4f },\n",
+			sorted.front(), total / sorted.size(), sorted[p99], sorted.back());
+		fprintf(file, "  \"draw_calls\": { \"min\": %d, \"avg\": %.2f, \"max\": %d },\n",
+			minDraws, (double)totalDraws / drawCalls.size(), maxDraws);
+		// the engine's own per-frame work only; what the GL driver allocates is not counted (see HeapAllocations)
+		fprintf(file, "  \"heap_allocations\": { \"avg\": %.2f, \"max\": %d, \"counted\": \"engine, GL driver excluded\" },\n",
+			(double)totalAllocations / allocations.size(), maxAllocations);
+		// throughput: triangles of an average frame over the average frame time
+		fprintf(file, "  \"triangles\": { \"avg\": %.0f, \"max\": %lld, \"per_second\": %.0f },\n",
+			averageTriangles, maxTriangles, averageTriangles * sorted.size() / (total / 1000.0));
+		// overdraw: fragments the lit pass shaded per pixel of the framebuffer, the background counting as none
+		fprintf(file, "  \"shaded_fragments\": { \"avg\": %.0f, \"max\": %lld, \"per_pixel\": %.3f },\n",
+			averageFragments, maxFragments, pixels > 0 ? averageFragments / pixels : 0.0);
+		// program, vertex array and texture binds of the draws, and the redundant ones the state cache dropped
+		fprintf(file, "  \"binds\": { \"avg\": %.2f, \"max\": %d, \"skipped_avg\": %.2f }\n",
+			(double)totalBinds / binds.size(), maxBinds, (double)totalSkipped / skippedBinds.size());
+		fprintf(file, "}\n");
+		fclose(file);
+		return true;
+	}
+
+private:
+	struct PathStep
+	{
+		int frames;
+		bool move;
+		Camera_Movement movement;
+		float mouseX, mouseY;
+	};
+
+	void addStep(int frames, bool move, Camera_Movement movement, float mouseX, float mouseY)
+	{
+		PathStep step;
+		step.frames = frames;
+		step.move = move;
+		step.movement = movement;
+		step.mouseX = mouseX;
+		step.mouseY = mouseY;
+		steps.push_back(step);
+	}
+
+	int frameCount;
+	int frame;
+	int scriptLength;
+	std::vector<PathStep> steps;
+	std::vector<double> frameTimes;
+	std::vector<int> drawCalls;
+	std::vector<int> allocations;
+	std::vector<long long> triangles;
+	std::vector<long long> fragments;
+	std::vector<int> binds;
+	std::vector<int> skippedBinds;
+	const char* latheMode;
+	const char* renderer;
+	int pointLights;
+	const char* drawOrder;
+	bool depthPrepass;
+	long long pixels;
+};
+
+// Job system microbenchmark (--bench-jobs), written as JSON like the frame benchmark:
+//   spawn_wait_ns   create, run and wait for one empty job from the submitting thread
+//   fan_out_ns      per job, for a parent with FAN_OUT empty children
+//   steal_ns        from Run() on the submitting thread until a worker starts the job (avg and p99)
+//   parallel_for    a summing loop over 2^22 integers, serial and through ParallelFor
+class JobBenchmark
+{
+public:
+	// where --bench-jobs writes its results without --bench-out
+	static constexpr const char* DEFAULT_PATH = "bench_jobs.json";
+	static const int SPAWN_ROUNDS = 20000;
+	static const int FAN_OUT_ROUNDS = 200;
+	static const unsigned int FAN_OUT = 4000;
+	static const int STEAL_ROUNDS = 2000;
+	static const unsigned int SUM_GRAIN_BITS = 16;
+	static const int CHECKED_ROUNDS = 2000;
+	static const unsigned int ROUND_VALUES = 1 << 16;
+	static const unsigned int ROUND_GRAIN_BITS = 8;
+
+	static bool Run(JobSystem &jobs, const char* path)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int i = 0; i < SPAWN_ROUNDS; i++)
+		{
+			Job* job = jobs.Create(&emptyJob);
+			jobs.Run(job);
+			jobs.Wait(job);
+		}
+		double spawnWait = nanosecondsSince(start) / SPAWN_ROUNDS;
+
+		start = std::chrono::steady_clock::now();
+		for (int i = 0; i < FAN_OUT_ROUNDS; i++)
+		{
+			Job* root = jobs.Create(&emptyJob);
+			for (unsigned int j = 0; j < FAN_OUT; j++)
+				jobs.Run(jobs.Create(&emptyJob, NULL, root));
+			jobs.Run(root);
+			jobs.Wait(root);
+		}
+		double fanOut = nanosecondsSince(start) / ((double)FAN_OUT_ROUNDS * (FAN_OUT + 1));
+
+		// the submitting thread only watches, so every job has to be stolen
+		std::vector<double> steals;
+		if (jobs.ThreadCount() > 1)
+		{
+			std::atomic<long long> started(0);
+			for (int i = 0; i < STEAL_ROUNDS; i++)
+			{
+				started.store(0, std::memory_order_relaxed);
+				Job* job = jobs.Create(&stampJob, &started);
+				long long pushed = std::chrono::steady_clock::now().time_since_epoch().count();
+				jobs.Run(job);
+				while (!jobs.IsDone(job))
+					std::this_thread::yield();
+				steals.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::duration(started.load(std::memory_order_acquire) - pushed)).count());
+			}
+			std::sort(steals.begin(), steals.end());
+		}
+
+		std::vector<unsigned int> values(1 << 22);
+		for (size_t i = 0; i < values.size(); i++)
+			values[i] = (unsigned int)(i & 1023);
+		// both runs use the same loop, the parallel one on chunks of 2^SUM_GRAIN_BITS values
+		auto sumRange = [&](unsigned int begin, unsigned int end)
+		{
+			unsigned long long sum = 0;
+			for (unsigned int i = begin; i < end; i++)
+				sum += values[i];
+			return sum;
+		};
+		unsigned long long serialSum = 0;
+		for (int pass = 0; pass < 2; pass++)
+		{
+			// the first pass only warms the caches and the clock
+			start = std::chrono::steady_clock::now();
+			serialSum = sumRange(0, (unsigned int)values.size());
+		}
+		double serialMs = nanosecondsSince(start) / 1.0e6;
+		// the halves of a power of two range line up with the grain, so every chunk has its own slot
+		std::vector<unsigned long long> partialSums(values.size() >> SUM_GRAIN_BITS, 0);
+		start = std::chrono::steady_clock::now();
+		jobs.ParallelFor((unsigned int)values.size(), 1 << SUM_GRAIN_BITS, [&](unsigned int begin, unsigned int end)
+		{
+			partialSums[begin >> SUM_GRAIN_BITS] = sumRange(begin, end);
+		});
+		double parallelMs = nanosecondsSince(start) / 1.0e6;
+		unsigned long long parallelSum = 0;
+		for (size_t i = 0; i < partialSums.size(); i++)
+			parallelSum += partialSums[i];
+
+		// many short checked rounds: job slots are reused as soon as their waiter returns, so a scheduler that
+		// still touches a job after it is done breaks the sum of some later round
+		std::vector<unsigned long long> roundSums(ROUND_VALUES >> ROUND_GRAIN_BITS);
+		unsigned long long roundExpected = sumRange(0, ROUND_VALUES);
+		int failedRounds = 0;
+		for (int i = 0; i < CHECKED_ROUNDS; i++)
+		{
+			std::fill(roundSums.begin(), roundSums.end(), 0);
+			jobs.ParallelFor(ROUND_VALUES, 1 << ROUND_GRAIN_BITS, [&](unsigned int begin, unsigned int end)
+			{
+				roundSums[begin >> ROUND_GRAIN_BITS] = sumRange(begin, end);
+			});
+			unsigned long long sum = 0;
+			for (size_t j = 0; j < roundSums.size(); j++)
+				sum += roundSums[j];
+			if (sum != roundExpected)
+				failedRounds++;
+		}
+
+		// the same sums as a frame's dependency graph: a job that splits the range into chunks, continued by one
+		// that adds up their sums, both under a frame job that is all the round waits for
+		GraphRound round;
+		round.values = &values;
+		int failedGraphs = 0;
+		start = std::chrono::steady_clock::now();
+		for (int i = 0; i < CHECKED_ROUNDS; i++)
+		{
+			round.total = 0;
+			Job* frame = jobs.Create(&emptyJob);
+			Job* sums = jobs.Create(&graphSumsJob, &round, frame);
+			Job* total = jobs.Create(&graphTotalJob, &round);
+			jobs.AddContinuation(sums, total);
+			jobs.Run(sums);
+			jobs.Run(frame);
+			jobs.Wait(frame);
+			if (round.total != roundExpected)
+				failedGraphs++;
+		}
+		double graphNs = nanosecondsSince(start) / CHECKED_ROUNDS;
+
+		FILE* file = fopen(path, "w");
+		if (file == NULL)
+			return false;
+		fprintf(file, "{\n");
+		fprintf(file, "  \"threads\": %u,\n", jobs.ThreadCount());
+		fprintf(file, "  \"spawn_wait_ns\": %.1f,\n", spawnWait);
+		fprintf(file, "  \"fan_out_ns\": %.1f,\n", fanOut);
+		if (steals.empty())
+			fprintf(file, "  \"steal_ns\": null,\n");
+		else
+		{
+			double total = 0.0;
+			for (size_t i = 0; i < steals.size(); i++)
+				total += steals[i];
+			fprintf(file, "  \"steal_ns\": { \"avg\": %.1f, \"p99\": %.1f },\n", total / steals.size(), steals[(size_t)(0.99 * (steals.size() - 1) + 0.5)]);
+		}
+		fprintf(file, "  \"parallel_for\": { \"serial_ms\": %.3f, \"parallel_ms\": %.3f, \"sums_match\": %s },\n",
+			serialMs, parallelMs, serialSum == parallelSum ? "true" : "false");
+		fprintf(file, "  \"checked_rounds\": { \"rounds\": %d, \"failed\": %d },\n", CHECKED_ROUNDS, failedRounds);
+		fprintf(file, "  \"graph\": { \"rounds\": %d, \"round_ns\": %.1f, \"failed\": %d }\n", CHECKED_ROUNDS, graphNs, failedGraphs);
+		fprintf(file, "}\n");
+		fclose(file);
+		return true;
+	}
+
+private:
+	struct GraphRound
+	{
+		const std::vector<unsigned int>* values;
+		unsigned long long partials[ROUND_VALUES >> ROUND_GRAIN_BITS];
+		unsigned long long total;
+	};
+
+	static double nanosecondsSince(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	static void emptyJob(JobSystem &, Job &)
+	{
+	}
+
+	// one child per chunk of the round's values, each summing its chunk into the round's partials
+	static void graphSumsJob(JobSystem &jobs, Job &job)
+	{
+		for (unsigned int begin = 0; begin < ROUND_VALUES; begin += 1 << ROUND_GRAIN_BITS)
+		{
+			Job* chunk = jobs.Create(&graphChunkJob, job.data, &job);
+			chunk->begin = begin;
+			chunk->end = begin + (1 << ROUND_GRAIN_BITS);
+			jobs.Run(chunk);
+		}
+	}
+
+	static void graphChunkJob(JobSystem &, Job &job)
+	{
+		GraphRound &round = *(GraphRound*)job.data;
+		unsigned long long sum = 0;
+		for (unsigned int i = job.begin; i < job.end; i++)
+			sum += (*round.values)[i];
+		round.partials[job.begin >> ROUND_GRAIN_BITS] = sum;
+	}
+
+	static void graphTotalJob(JobSystem &, Job &job)
+	{
+		GraphRound &round = *(GraphRound*)job.data;
+		for (unsigned int i = 0; i < (ROUND_VALUES >> ROUND_GRAIN_BITS); i++)
+			round.total += round.partials[i];
+	}
+
+	// stores its start time in the atomic its data points to
+	static void stampJob(JobSystem &, Job &job)
+	{
+		long long now = std::chrono::steady_clock::now().time_since_epoch().count();
+		((std::atomic<long long>*)job.data)->store(now, std::memory_order_release);
+	}
+};
+#endif
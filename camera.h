@@ -5,6 +5,9 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "culling.h"
+#include "shader.h"
+
 #include <vector>
 
 // Defines several possible options for camera movement. Used as abstraction to stay away from window-system specific input methods
@@ -23,9 +26,25 @@ const float PITCH = -12.0f;
 const float SPEED = 2.5f;
 const float SENSITIVITY = 0.1f;
 const float ZOOM = 45.0f;
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 100.0f;
+
 
+// everything a frame needs from the camera, copied out so it can be handed to another thread
+struct CameraState
+{
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::mat4 viewProjection;
+	Frustum frustum;
+	glm::vec3 position;
+	glm::vec3 front;
+	unsigned int version;
+};
 
-// An abstract camera class that processes input and calculates the corresponding Euler Angles, Vectors and Matrices for use in OpenGL
+// An abstract camera class that processes input and calculates the corresponding Euler Angles, Vectors and Matrices for use in OpenGL.
+// The view, projection and view-projection matrices and the frustum are cached and only rebuilt after the camera moved, turned,
+// or its viewport or projection changed; Version() counts those changes. Call Invalidate() after writing the public attributes directly.
 class Camera
 {
 public:
@@ -44,7 +63,7 @@ public:
 	float Zoom;
 
 	// constructor with vectors
-	Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
+	Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM), aspect(4.0f / 3.0f), orthographic(false), dirty(true), version(0)
 	{
 		Position = position;
 		WorldUp = up;
@@ -53,7 +72,7 @@ public:
 		updateCameraVectors();
 	}
 	// constructor with scalar values
-	Camera(float posX, float posY, float posZ, float upX, float upY, float upZ, float yaw, float pitch) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
+	Camera(float posX, float posY, float posZ, float upX, float upY, float upZ, float yaw, float pitch) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM), aspect(4.0f / 3.0f), orthographic(false), dirty(true), version(0)
 	{
 		Position = glm::vec3(posX, posY, posZ);
 		WorldUp = glm::vec3(upX, upY, upZ);
@@ -63,9 +82,68 @@ public:
 	}
 
 	// returns the view matrix calculated using Euler Angles and the LookAt Matrix
-	glm::mat4 GetViewMatrix()
+	const glm::mat4& GetViewMatrix()
+	{
+		update();
+		return state.view;
+	}
+
+	// perspective from Zoom and the viewport aspect, or the fixed orthographic view
+	const glm::mat4& GetProjectionMatrix()
+	{
+		update();
+		return state.projection;
+	}
+
+	const glm::mat4& GetViewProjectionMatrix()
+	{
+		update();
+		return state.viewProjection;
+	}
+
+	const Frustum& GetFrustum()
+	{
+		update();
+		return state.frustum;
+	}
+
+	// matrices, frustum and position in one piece
+	const CameraState& GetState()
+	{
+		update();
+		return state;
+	}
+
+	// framebuffer size; a zero size (minimized window) keeps the last aspect
+	void SetViewport(int width, int height)
+	{
+		if (width <= 0 || height <= 0 || aspect == (float)width / (float)height)
+			return;
+		aspect = (float)width / (float)height;
+		Invalidate();
+	}
+
+	void SetOrthographic(bool enabled)
+	{
+		if (orthographic == enabled)
+			return;
+		orthographic = enabled;
+		Invalidate();
+	}
+
+	// the cached matrices are rebuilt on next use
+	void Invalidate()
+	{
+		// versions are unique across cameras, so assigning a new camera is noticed as well
+		static unsigned int lastVersion = 0;
+		dirty = true;
+		version = ++lastVersion;
+	}
+
+	// changes whenever the matrices do
+	unsigned int Version() const
 	{
-		return glm::lookAt(Position, Position + Front, Up);
+		return version;
 	}
 
 	// processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
@@ -84,6 +162,7 @@ public:
 			Position += Up * velocity;
 		if (direction == DOWN)
 			Position -= Up * velocity;
+		Invalidate();
 	}
 
 	// processes input received from a mouse input system. Expects the offset value in both the x and y direction.
@@ -122,6 +201,7 @@ private:
 	// calculates the front vector from the Camera's (updated) Euler Angles
 	void updateCameraVectors()
 	{
+		Invalidate();
 		// calculate the new Front vector
 		glm::vec3 front;
 		front.x = cos(glm::radians(Yaw)) * cos(glm::radians(Pitch));
@@ -132,5 +212,76 @@ private:
 		Right = glm::normalize(glm::cross(Front, WorldUp));  // normalize the vectors, because their length gets closer to 0 the more you look up or down which results in slower movement.
 		Up = glm::normalize(glm::cross(Right, Front));
 	}
+
+	void update()
+	{
+		if (!dirty)
+			return;
+		state.view = glm::lookAt(Position, Position + Front, Up);
+		if (orthographic)
+			state.projection = glm::ortho(-2.0f, 2.0f, -2.0f, 2.0f, NEAR_PLANE, FAR_PLANE);
+		else
+			state.projection = glm::perspective(glm::radians(Zoom), aspect, NEAR_PLANE, FAR_PLANE);
+		state.viewProjection = state.projection * state.view;
+		state.frustum.Extract(state.viewProjection);
+		state.position = Position;
+		state.front = Front;
+		state.version = version;
+		dirty = false;
+	}
+
+	float aspect;
+	bool orthographic;
+	bool dirty;
+	unsigned int version;
+	CameraState state;
+};
+
+// The camera uniform block (shaderfiles/camera.glsl, std140) shared by every program: one buffer bound to
+// CAMERA_BLOCK_BINDING, rewritten only when the camera's matrices changed since the last Publish().
+class CameraBuffer
+{
+public:
+	CameraBuffer() : UBO(0), publishedVersion(0), published(false) {}
+
+	void Init()
+	{
+		glGenBuffers(1, &UBO);
+		glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, UBO);
+	}
+
+	// call once per frame, before drawing
+	void Publish(const CameraState &camera)
+	{
+		if (published && camera.version == publishedVersion)
+			return;
+		Block block;
+		block.projection = camera.projection;
+		block.view = camera.view;
+		block.viewProjection = camera.viewProjection;
+		block.position = glm::vec4(camera.position, 1.0f);
+		glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Block), &block);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		publishedVersion = camera.version;
+		published = true;
+	}
+
+private:
+	// std140 layout of the block; every member is 16 byte aligned
+	struct Block
+	{
+		glm::mat4 projection;
+		glm::mat4 view;
+		glm::mat4 viewProjection;
+		glm::vec4 position;
+	};
+
+	unsigned int UBO;
+	unsigned int publishedVersion;
+	bool published;
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,230 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define CULLING_SSE
+#include <xmmintrin.h>
+#endif
+
+// axis aligned box and bounding sphere of a mesh in its own (model) space
+struct AABB
+{
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+struct BoundingSphere
+{
+	glm::vec3 center;
+	float radius;
+};
+
+// bounds of interleaved vertex data whose first three floats per vertex are the position; the sphere is
+// centred on the box, which is tight enough for the lathed pieces and cheaper than a minimal sphere
+inline void ComputeBounds(const std::vector<float>& vertices, unsigned int stride, AABB& box, BoundingSphere& sphere)
+{
+	box.min = glm::vec3(0.0f);
+	box.max = glm::vec3(0.0f);
+	if (vertices.size() < stride)
+	{
+		sphere.center = glm::vec3(0.0f);
+		sphere.radius = 0.0f;
+		return;
+	}
+	box.min = box.max = glm::vec3(vertices[0], vertices[1], vertices[2]);
+	for (size_t i = stride; i + 2 < vertices.size(); i += stride)
+	{
+		glm::vec3 p(vertices[i], vertices[i + 1], vertices[i + 2]);
+		box.min = glm::min(box.min, p);
+		box.max = glm::max(box.max, p);
+	}
+	sphere.center = (box.min + box.max) * 0.5f;
+	float radiusSquared = 0.0f;
+	for (size_t i = 0; i + 2 < vertices.size(); i += stride)
+	{
+		glm::vec3 d = glm::vec3(vertices[i], vertices[i + 1], vertices[i + 2]) - sphere.center;
+		float distanceSquared = glm::dot(d, d);
+		if (distanceSquared > radiusSquared)
+			radiusSquared = distanceSquared;
+	}
+	sphere.radius = std::sqrt(radiusSquared);
+}
+
+// the sphere after a model transform; non uniform scale grows the radius by the largest axis scale
+inline BoundingSphere TransformSphere(const BoundingSphere& sphere, const glm::mat4& model)
+{
+	BoundingSphere result;
+	result.center = glm::vec3(model * glm::vec4(sphere.center, 1.0f));
+	float scaleX = glm::dot(glm::vec3(model[0]), glm::vec3(model[0]));
+	float scaleY = glm::dot(glm::vec3(model[1]), glm::vec3(model[1]));
+	float scaleZ = glm::dot(glm::vec3(model[2]), glm::vec3(model[2]));
+	float scale = scaleX > scaleY ? scaleX : scaleY;
+	scale = scale > scaleZ ? scale : scaleZ;
+	result.radius = sphere.radius * std::sqrt(scale);
+	return result;
+}
+
+// The six planes of a view frustum, taken straight from the rows of projection * view (Gribb & Hartmann).
+// Each plane is normalized so a plane equation gives the signed distance, with the inside positive.
+struct Frustum
+{
+	glm::vec4 planes[6];
+
+	void Extract(const glm::mat4& viewProjection)
+	{
+		// glm is column major: row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+		glm::vec4 rows[4];
+		for (int i = 0; i < 4; i++)
+			rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+		planes[0] = rows[3] + rows[0]; // left
+		planes[1] = rows[3] - rows[0]; // right
+		planes[2] = rows[3] + rows[1]; // bottom
+		planes[3] = rows[3] - rows[1]; // top
+		planes[4] = rows[3] + rows[2]; // near
+		planes[5] = rows[3] - rows[2]; // far
+		for (int i = 0; i < 6; i++)
+			planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+
+	bool IntersectsSphere(const BoundingSphere& sphere) const
+	{
+		for (int i = 0; i < 6; i++)
+			if (glm::dot(glm::vec3(planes[i]), sphere.center) + planes[i].w < -sphere.radius)
+				return false;
+		return true;
+	}
+};
+
+// World space bounding spheres of every instance in structure of arrays form, padded to a multiple of four
+// so the frustum test can run on four spheres at a time.
+class SphereSet
+{
+public:
+	SphereSet() : count(0) {}
+
+	void Clear()
+	{
+		x.clear();
+		y.clear();
+		z.clear();
+		radius.clear();
+		count = 0;
+	}
+
+	void Add(const BoundingSphere& sphere)
+	{
+		// drop the padding, append, pad again
+		x.resize(count);
+		y.resize(count);
+		z.resize(count);
+		radius.resize(count);
+		x.push_back(sphere.center.x);
+		y.push_back(sphere.center.y);
+		z.push_back(sphere.center.z);
+		radius.push_back(sphere.radius);
+		count++;
+		size_t padded = (count + 3) & ~(size_t)3;
+		x.resize(padded, 0.0f);
+		y.resize(padded, 0.0f);
+		z.resize(padded, 0.0f);
+		radius.resize(padded, 0.0f);
+	}
+
+	void Set(size_t index, const BoundingSphere& sphere)
+	{
+		x[index] = sphere.center.x;
+		y[index] = sphere.center.y;
+		z[index] = sphere.center.z;
+		radius[index] = sphere.radius;
+	}
+
+	BoundingSphere Get(size_t index) const
+	{
+		BoundingSphere sphere;
+		sphere.center = glm::vec3(x[index], y[index], z[index]);
+		sphere.radius = radius[index];
+		return sphere;
+	}
+
+	size_t Size() const { return count; }
+
+	// writes 1 to visible[i] for every sphere that touches the frustum and 0 otherwise; returns the number
+	// of visible spheres
+	size_t Cull(const Frustum& frustum, std::vector<unsigned char>& visible) const
+	{
+		visible.resize(x.size());
+		return CullBlocks(frustum, visible, 0, Blocks());
+	}
+
+	// groups of four spheres, the unit CullBlocks works in
+	size_t Blocks() const
+	{
+		return x.size() / 4;
+	}
+
+	// Cull() for the spheres of blocks [firstBlock, endBlock) only, so separate threads can take separate
+	// ranges; 'visible' must already hold 4 * Blocks() entries
+	size_t CullBlocks(const Frustum& frustum, std::vector<unsigned char>& visible, size_t firstBlock, size_t endBlock) const
+	{
+		size_t visibleCount = 0;
+		size_t first = firstBlock * 4, end = endBlock * 4;
+#ifdef CULLING_SSE
+		__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+		for (int p = 0; p < 6; p++)
+		{
+			planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+			planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+			planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+			planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+		}
+		for (size_t i = first; i < end; i += 4)
+		{
+			__m128 sx = _mm_loadu_ps(&x[i]);
+			__m128 sy = _mm_loadu_ps(&y[i]);
+			__m128 sz = _mm_loadu_ps(&z[i]);
+			__m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&radius[i]));
+			__m128 inside = _mm_cmpeq_ps(sx, sx);
+			for (int p = 0; p < 6; p++)
+			{
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, planeX[p]), _mm_mul_ps(sy, planeY[p])),
+					_mm_add_ps(_mm_mul_ps(sz, planeZ[p]), planeW[p]));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+			}
+			int mask = _mm_movemask_ps(inside);
+			for (int lane = 0; lane < 4; lane++)
+				visible[i + lane] = (unsigned char)((mask >> lane) & 1);
+		}
+#else
+		for (size_t i = first; i < end; i++)
+		{
+			BoundingSphere sphere;
+			sphere.center = glm::vec3(x[i], y[i], z[i]);
+			sphere.radius = radius[i];
+			visible[i] = frustum.IntersectsSphere(sphere) ? 1 : 0;
+		}
+#endif
+		// the padding is never drawn
+		for (size_t i = count > first ? count : first; i < end; i++)
+			visible[i] = 0;
+		for (size_t i = first; i < end && i < count; i++)
+			visibleCount += visible[i];
+		return visibleCount;
+	}
+
+private:
+	std::vector<float> x, y, z, radius;
+	size_t count;
+};
+
+// per frame culling counters
+struct CullStats
+{
+	unsigned int visible;
+	unsigned int culled;
+};
+#endif
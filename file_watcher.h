@@ -0,0 +1,150 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <chrono>
+#include <thread>
+#endif
+
+// Reports edits to a set of files inside one directory. On Linux the directory is watched with inotify, on
+// Windows with a change notification handle; anywhere else the modification times are polled. Wait() blocks
+// for at most the given timeout, so the thread calling it can be stopped.
+class FileWatcher
+{
+public:
+	FileWatcher(const std::string &directory) : directory(directory)
+	{
+#if defined(__linux__)
+		inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (inotifyFd >= 0)
+			inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+#elif defined(_WIN32)
+		changeHandle = FindFirstChangeNotificationA(directory.c_str(), FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+#endif
+	}
+
+	~FileWatcher()
+	{
+#if defined(__linux__)
+		if (inotifyFd >= 0)
+			close(inotifyFd);
+#elif defined(_WIN32)
+		if (changeHandle != INVALID_HANDLE_VALUE)
+			FindCloseChangeNotification(changeHandle);
+#endif
+	}
+
+	// files are given with the directory prefix, the same way they are passed to the Shader class
+	void AddFile(const std::string &path)
+	{
+		for (size_t i = 0; i < files.size(); i++)
+			if (files[i].path == path)
+				return;
+		WatchedFile file;
+		file.path = path;
+		file.modified = modificationTime(path);
+		files.push_back(file);
+	}
+
+	// waits up to timeoutMs for edits and appends every watched file that changed to 'changed'
+	void Wait(int timeoutMs, std::vector<std::string> &changed)
+	{
+#if defined(__linux__)
+		if (inotifyFd < 0)
+			return;
+		pollfd descriptor;
+		descriptor.fd = inotifyFd;
+		descriptor.events = POLLIN;
+		if (poll(&descriptor, 1, timeoutMs) <= 0)
+			return;
+		// editors tend to save in several steps; drain everything that is queued
+		char buffer[4096];
+		ssize_t length;
+		while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+		{
+			for (char* cursor = buffer; cursor < buffer + length;)
+			{
+				inotify_event* event = (inotify_event*)cursor;
+				if (event->len > 0)
+					addChanged(directory + "/" + event->name, changed);
+				cursor += sizeof(inotify_event) + event->len;
+			}
+		}
+#else
+#if defined(_WIN32)
+		if (changeHandle == INVALID_HANDLE_VALUE || WaitForSingleObject(changeHandle, (DWORD)timeoutMs) != WAIT_OBJECT_0)
+			return;
+		FindNextChangeNotification(changeHandle);
+#else
+		std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+#endif
+		for (size_t i = 0; i < files.size(); i++)
+		{
+			long long modified = modificationTime(files[i].path);
+			if (modified != files[i].modified)
+			{
+				files[i].modified = modified;
+				changed.push_back(files[i].path);
+			}
+		}
+#endif
+	}
+
+private:
+	struct WatchedFile
+	{
+		std::string path;
+		long long modified;
+	};
+
+	FileWatcher(const FileWatcher&);
+	FileWatcher& operator=(const FileWatcher&);
+
+	static long long modificationTime(const std::string &path)
+	{
+#ifdef _WIN32
+		struct _stat info;
+		return _stat(path.c_str(), &info) == 0 ? (long long)info.st_mtime : 0;
+#else
+		struct stat info;
+		return stat(path.c_str(), &info) == 0 ? (long long)info.st_mtime : 0;
+#endif
+	}
+
+	void addChanged(const std::string &path, std::vector<std::string> &changed)
+	{
+		bool watched = false;
+		for (size_t i = 0; i < files.size(); i++)
+			if (files[i].path == path)
+				watched = true;
+		for (size_t i = 0; i < changed.size(); i++)
+			if (changed[i] == path)
+				return;
+		if (watched)
+			changed.push_back(path);
+	}
+
+	std::string directory;
+	std::vector<WatchedFile> files;
+#if defined(__linux__)
+	int inotifyFd;
+#elif defined(_WIN32)
+	HANDLE changeHandle;
+#endif
+};
+#endif
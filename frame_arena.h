@@ -0,0 +1,211 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+// Linear allocator for data that lives for one frame: draw lists, batches, transforms. Allocating bumps a
+// pointer, freeing does nothing, and BeginFrame() drops everything at once. The arena is double buffered, so
+// what a thread allocated in the previous frame is still valid during this one (e.g. while another thread
+// reads it); it is reclaimed one frame later. Each thread has its own arena (Local()), so nothing is shared.
+//
+// When a frame needs more than the capacity the rest comes from the heap and is freed with that half; the
+// high water mark shows what capacity would have been enough.
+class FrameArena
+{
+public:
+	static const size_t DEFAULT_CAPACITY = 1 << 20;
+
+	explicit FrameArena(size_t capacity = DEFAULT_CAPACITY) : current(0), highWater(0)
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			halves[i].memory = (unsigned char*)std::malloc(capacity);
+			halves[i].capacity = halves[i].memory ? capacity : 0;
+			halves[i].used = 0;
+			halves[i].overflowBytes = 0;
+		}
+	}
+
+	~FrameArena()
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			releaseOverflow(halves[i]);
+			std::free(halves[i].memory);
+		}
+	}
+
+	// the calling thread's arena
+	static FrameArena& Local()
+	{
+		static thread_local FrameArena arena;
+		return arena;
+	}
+
+	// switches to the other half and empties it; everything allocated two frames ago is gone
+	void BeginFrame()
+	{
+		current ^= 1;
+		Half &half = halves[current];
+		releaseOverflow(half);
+		half.used = 0;
+		half.overflowBytes = 0;
+	}
+
+	void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t))
+	{
+		Half &half = halves[current];
+		size_t start = (half.used + alignment - 1) & ~(alignment - 1);
+		if (start + size <= half.capacity)
+		{
+			half.used = start + size;
+			noteUsage(half);
+			return half.memory + start;
+		}
+		// malloc aligns for any fundamental type, which is all the frame data asks for
+		void* block = std::malloc(size > 0 ? size : 1);
+		if (block == NULL)
+			throw std::bad_alloc();
+		half.overflow.push_back(block);
+		half.overflowBytes += size;
+		noteUsage(half);
+		return block;
+	}
+
+	template <typename T>
+	T* Allocate(size_t count)
+	{
+		return (T*)Allocate(count * sizeof(T), alignof(T));
+	}
+
+	// bytes handed out this frame
+	size_t Used() const
+	{
+		return halves[current].used + halves[current].overflowBytes;
+	}
+
+	// most bytes any single frame used so far
+	size_t HighWater() const
+	{
+		return highWater;
+	}
+
+private:
+	struct Half
+	{
+		unsigned char* memory;
+		size_t capacity;
+		size_t used;
+		std::vector<void*> overflow;
+		size_t overflowBytes;
+	};
+
+	void noteUsage(const Half &half)
+	{
+		size_t total = half.used + half.overflowBytes;
+		if (total > highWater)
+			highWater = total;
+	}
+
+	static void releaseOverflow(Half &half)
+	{
+		for (size_t i = 0; i < half.overflow.size(); i++)
+			std::free(half.overflow[i]);
+		half.overflow.clear();
+	}
+
+	Half halves[2];
+	int current;
+	size_t highWater;
+};
+
+// STL allocator on a frame arena, e.g. std::vector<glm::mat4, FrameAllocator<glm::mat4> >. Containers built
+// with it must not outlive the frame after next; they never free, so grow them with reserve() when the size
+// is known.
+template <typename T>
+class FrameAllocator
+{
+public:
+	typedef T value_type;
+
+	FrameAllocator() : arena(&FrameArena::Local()) {}
+	explicit FrameAllocator(FrameArena &arena) : arena(&arena) {}
+	template <typename U>
+	FrameAllocator(const FrameAllocator<U> &other) : arena(other.arena) {}
+
+	T* allocate(size_t count)
+	{
+		return arena->Allocate<T>(count);
+	}
+
+	void deallocate(T*, size_t)
+	{
+	}
+
+	template <typename U>
+	bool operator==(const FrameAllocator<U> &other) const
+	{
+		return arena == other.arena;
+	}
+	template <typename U>
+	bool operator!=(const FrameAllocator<U> &other) const
+	{
+		return arena != other.arena;
+	}
+
+private:
+	template <typename U>
+	friend class FrameAllocator;
+
+	FrameArena* arena;
+};
+
+// Heap allocations made by the engine's own per-frame work. The counting operators are defined once, in
+// Source.cpp, and call Record() for every allocation, but only those made inside a Scope count: the render
+// loop opens one around its CPU stages (input, culling, level of detail, batching, the render queue) and
+// every job runs in one, so the workers of the job system count too. GL calls stay outside, since the driver
+// allocates for itself (Mesa's tessellator does, every frame); the render loop compares the count around a
+// frame to prove that its own steady state allocates nothing.
+class HeapAllocations
+{
+public:
+	// counts the calling thread's allocations while it exists; scopes nest
+	class Scope
+	{
+	public:
+		Scope() { depth()++; }
+		~Scope() { depth()--; }
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+	};
+
+	static void Record()
+	{
+		if (depth() > 0)
+			total().fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// allocations counted so far, on all threads
+	static unsigned long long Count()
+	{
+		return total().load(std::memory_order_relaxed);
+	}
+
+private:
+	static int& depth()
+	{
+		static thread_local int scopes = 0;
+		return scopes;
+	}
+
+	static std::atomic<unsigned long long>& total()
+	{
+		static std::atomic<unsigned long long> count(0);
+		return count;
+	}
+};
+#endif
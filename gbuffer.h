@@ -0,0 +1,158 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include <glad/glad.h>
+
+#include <iostream>
+
+// Render targets of the deferred renderer (--deferred). The pieces and the board write their surface here
+// (shaderfiles/gbuffer.fs) instead of lighting it, and the lights read it back per pixel (shaderfiles/deferred.fs),
+// so a light costs the pixels it reaches rather than every fragment of every draw. The surface is kept thin,
+// twelve bytes a pixel besides depth:
+//   albedo       RGBA8                diffuse map color
+//   specular     RGBA8                specular map color, shininess in alpha
+//   normal       RG16                 octahedral world space normal
+//   depth        DEPTH_COMPONENT24    the world position is rebuilt from it
+// The lights add up in a target of their own, so many small contributions aren't rounded to 8 bits one by one:
+//   light        RGBA16F              sum of the lights, copied to the framebuffer at the end
+//   light depth  DEPTH_COMPONENT24    copy of the surface depth that the point light volumes are tested against
+// It also owns what the lights are drawn with: one triangle covering the screen and a cube for point light volumes.
+class GBuffer
+{
+public:
+	enum Target { ALBEDO, SPECULAR, NORMAL, DEPTH, LIGHT, LIGHT_DEPTH, TARGETS };
+
+	GBuffer() : surfaceFBO(0), lightFBO(0), width(0), height(0), emptyVAO(0), volumeVAO(0), volumeVBO(0), volumeEBO(0)
+	{
+		for (int i = 0; i < TARGETS; i++)
+			textures[i] = 0;
+	}
+
+	// sizes the targets like the framebuffer they are resolved into; nothing happens when the size is unchanged.
+	// The first call creates everything, so the context must be current
+	void Resize(int newWidth, int newHeight)
+	{
+		if (surfaceFBO != 0 && newWidth == width && newHeight == height)
+			return;
+		if (surfaceFBO == 0)
+			init();
+		width = newWidth;
+		height = newHeight;
+		static const GLint internalFormats[TARGETS] = { GL_RGBA8, GL_RGBA8, GL_RG16, GL_DEPTH_COMPONENT24, GL_RGBA16F, GL_DEPTH_COMPONENT24 };
+		static const GLenum formats[TARGETS] = { GL_RGBA, GL_RGBA, GL_RG, GL_DEPTH_COMPONENT, GL_RGBA, GL_DEPTH_COMPONENT };
+		static const GLenum types[TARGETS] = { GL_UNSIGNED_BYTE, GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT, GL_UNSIGNED_INT, GL_FLOAT, GL_UNSIGNED_INT };
+		for (int i = 0; i < TARGETS; i++)
+		{
+			glBindTexture(GL_TEXTURE_2D, textures[i]);
+			glTexImage2D(GL_TEXTURE_2D, 0, internalFormats[i], width, height, 0, formats[i], types[i], NULL);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, surfaceFBO);
+		for (int i = 0; i < DEPTH; i++)
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, textures[i], 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, textures[DEPTH], 0);
+		bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		glBindFramebuffer(GL_FRAMEBUFFER, lightFBO);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[LIGHT], 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, textures[LIGHT_DEPTH], 0);
+		if (!complete || glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "G-buffer framebuffer is incomplete" << std::endl;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	// directs the following draws into the surface targets
+	void Bind() const
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, surfaceFBO);
+	}
+
+	// directs the following draws into the light targets
+	void BindLight() const
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, lightFBO);
+	}
+
+	// binds the surface targets, in Target order, to the texture units from firstUnit on
+	void BindTextures(int firstUnit) const
+	{
+		for (int i = 0; i <= DEPTH; i++)
+			BindTexture((Target)i, firstUnit + i);
+	}
+
+	// binds one target, e.g. the summed light for the last copy
+	void BindTexture(Target target, int unit) const
+	{
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(GL_TEXTURE_2D, textures[target]);
+	}
+
+	// one triangle over the whole viewport; the vertex shader places its corners from gl_VertexID
+	void DrawFullScreen() const
+	{
+		glBindVertexArray(emptyVAO);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+	}
+
+	// 'count' instances of a cube from -1 to 1, wound counter-clockwise seen from outside so either side can be culled
+	void DrawLightVolumes(int count) const
+	{
+		glBindVertexArray(volumeVAO);
+		glDrawElementsInstanced(GL_TRIANGLES, 36, GL_UNSIGNED_SHORT, NULL, count);
+	}
+
+private:
+	void init()
+	{
+		glGenFramebuffers(1, &surfaceFBO);
+		glGenFramebuffers(1, &lightFBO);
+		glGenTextures(TARGETS, textures);
+		for (int i = 0; i < TARGETS; i++)
+		{
+			// read back texel for texel, never filtered
+			glBindTexture(GL_TEXTURE_2D, textures[i]);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, surfaceFBO);
+		const GLenum drawBuffers[DEPTH] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+		glDrawBuffers(DEPTH, drawBuffers);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		// a core profile draws nothing without a vertex array, even one without attributes
+		glGenVertexArrays(1, &emptyVAO);
+
+		// corner i is at (x, y, z) = (bit 0, bit 1, bit 2) of i, mapped to -1 and 1
+		float corners[8 * 3];
+		for (int i = 0; i < 8; i++)
+		{
+			corners[i * 3 + 0] = (i & 1) ? 1.0f : -1.0f;
+			corners[i * 3 + 1] = (i & 2) ? 1.0f : -1.0f;
+			corners[i * 3 + 2] = (i & 4) ? 1.0f : -1.0f;
+		}
+		static const unsigned short indices[36] = {
+			0, 6, 2, 0, 4, 6,  1, 3, 7, 1, 7, 5,  // -x +x
+			0, 1, 5, 0, 5, 4,  2, 7, 3, 2, 6, 7,  // -y +y
+			0, 3, 1, 0, 2, 3,  4, 5, 7, 4, 7, 6   // -z +z
+		};
+		glGenVertexArrays(1, &volumeVAO);
+		glGenBuffers(1, &volumeVBO);
+		glGenBuffers(1, &volumeEBO);
+		glBindVertexArray(volumeVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, volumeVBO);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, volumeEBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+		glEnableVertexAttribArray(0);
+		glBindVertexArray(0);
+	}
+
+	unsigned int surfaceFBO, lightFBO;
+	unsigned int textures[TARGETS];
+	int width, height;
+	unsigned int emptyVAO;
+	unsigned int volumeVAO, volumeVBO, volumeEBO;
+};
+#endif
@@ -0,0 +1,93 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+#include "shader.h"
+
+// Shadow copy of the GL bindings the draws change most: the program, the vertex array and the texture of each
+// unit. A bind that matches the copy never reaches the driver; the binds made and the ones skipped are counted
+// for the profiler. The copy only knows about binds that went through it, so after code that binds on its own
+// (the lighting passes, the profiler overlay, uniform setup) call Reset() and the next bind of each kind is
+// made again.
+class GLStateCache
+{
+public:
+	static const int TEXTURE_UNITS = 8;
+	// no GL object has this name, so a binding set to it never matches
+	static const unsigned int UNKNOWN = 0xFFFFFFFFu;
+
+	GLStateCache() : binds(0), skippedBinds(0)
+	{
+		Reset();
+	}
+
+	// forgets every binding
+	void Reset()
+	{
+		program = UNKNOWN;
+		vertexArray = UNKNOWN;
+		activeUnit = -1;
+		for (int i = 0; i < TEXTURE_UNITS; i++)
+			textures[i] = UNKNOWN;
+	}
+
+	void UseProgram(Shader &shader)
+	{
+		if (shader.ID == program)
+		{
+			skippedBinds++;
+			return;
+		}
+		shader.use();
+		program = shader.ID;
+		binds++;
+	}
+
+	void BindVertexArray(unsigned int VAO)
+	{
+		if (VAO == vertexArray)
+		{
+			skippedBinds++;
+			return;
+		}
+		glBindVertexArray(VAO);
+		vertexArray = VAO;
+		binds++;
+	}
+
+	// texture names are unique across targets, so the name alone tells whether 'unit' already has it
+	void BindTexture(int unit, GLenum target, unsigned int texture)
+	{
+		if (textures[unit] == texture)
+		{
+			skippedBinds++;
+			return;
+		}
+		if (unit != activeUnit)
+		{
+			glActiveTexture(GL_TEXTURE0 + unit);
+			activeUnit = unit;
+		}
+		glBindTexture(target, texture);
+		textures[unit] = texture;
+		binds++;
+	}
+
+	// binds made and skipped since the last ClearCounts()
+	int Binds() const { return binds; }
+	int SkippedBinds() const { return skippedBinds; }
+	void ClearCounts()
+	{
+		binds = 0;
+		skippedBinds = 0;
+	}
+
+private:
+	unsigned int program;
+	unsigned int vertexArray;
+	int activeUnit;
+	unsigned int textures[TEXTURE_UNITS];
+	int binds, skippedBinds;
+};
+#endif
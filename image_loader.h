@@ -0,0 +1,212 @@
+#ifndef IMAGE_LOADER_H
+#define IMAGE_LOADER_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A read only view of a whole file mapped into the address space. Decoding straight out of the mapping
+// skips the stdio buffering and the extra heap copy stbi_load would make of the compressed data.
+class MappedFile
+{
+public:
+	MappedFile(const char* path) : data(NULL), size(0)
+	{
+#ifdef _WIN32
+		fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		mappingHandle = NULL;
+		if (fileHandle == INVALID_HANDLE_VALUE)
+			return;
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+			return;
+		mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mappingHandle == NULL)
+			return;
+		data = (const unsigned char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+		if (data)
+			size = (size_t)fileSize.QuadPart;
+#else
+		fileDescriptor = open(path, O_RDONLY);
+		if (fileDescriptor < 0)
+			return;
+		struct stat fileInfo;
+		if (fstat(fileDescriptor, &fileInfo) != 0 || fileInfo.st_size == 0)
+			return;
+		void* mapping = mmap(NULL, (size_t)fileInfo.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+		if (mapping == MAP_FAILED)
+			return;
+		// the whole file is decoded front to back, so let the kernel read ahead
+		madvise(mapping, (size_t)fileInfo.st_size, MADV_SEQUENTIAL);
+		data = (const unsigned char*)mapping;
+		size = (size_t)fileInfo.st_size;
+#endif
+	}
+
+	~MappedFile()
+	{
+#ifdef _WIN32
+		if (data)
+			UnmapViewOfFile(data);
+		if (mappingHandle)
+			CloseHandle(mappingHandle);
+		if (fileHandle != INVALID_HANDLE_VALUE)
+			CloseHandle(fileHandle);
+#else
+		if (data)
+			munmap((void*)data, size);
+		if (fileDescriptor >= 0)
+			close(fileDescriptor);
+#endif
+	}
+
+	bool IsOpen() const { return data != NULL; }
+	const unsigned char* Data() const { return data; }
+	size_t Size() const { return size; }
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	const unsigned char* data;
+	size_t size;
+#ifdef _WIN32
+	HANDLE fileHandle;
+	HANDLE mappingHandle;
+#else
+	int fileDescriptor;
+#endif
+};
+
+// Bump allocator that backs every allocation stb_image makes while decoding. Nothing is released one by one;
+// Reset() rewinds the arena once the pixels have been uploaded, so after the first few images the decoder
+// runs without touching the heap at all.
+class ImageArena
+{
+public:
+	static ImageArena& Get()
+	{
+		static ImageArena arena;
+		return arena;
+	}
+
+	// NULL when the heap is out of memory, which stb_image reports as a failed decode
+	void* Allocate(size_t size)
+	{
+		size_t needed = HEADER_SIZE + align(size);
+		if ((blocks.empty() || blocks.back().used + needed > blocks.back().capacity) && !addBlock(needed))
+			return NULL;
+		Block& block = blocks.back();
+		unsigned char* header = block.memory + block.used;
+		*(size_t*)header = size;
+		block.used += needed;
+		lastAllocation = header + HEADER_SIZE;
+		return lastAllocation;
+	}
+
+	void* Reallocate(void* ptr, size_t newSize)
+	{
+		if (ptr == NULL)
+			return Allocate(newSize);
+		size_t oldSize = *(size_t*)((unsigned char*)ptr - HEADER_SIZE);
+		// the most recent allocation can simply grow in place when the block has room
+		if (ptr == lastAllocation)
+		{
+			Block& block = blocks.back();
+			size_t oldEnd = block.used;
+			size_t newEnd = oldEnd - align(oldSize) + align(newSize);
+			if (newEnd <= block.capacity)
+			{
+				block.used = newEnd;
+				*(size_t*)((unsigned char*)ptr - HEADER_SIZE) = newSize;
+				return ptr;
+			}
+		}
+		void* moved = Allocate(newSize);
+		// like realloc, a failure leaves the old allocation as it was
+		if (moved == NULL)
+			return NULL;
+		memcpy(moved, ptr, oldSize < newSize ? oldSize : newSize);
+		return moved;
+	}
+
+	// individual frees are ignored, the memory comes back on Reset()
+	void Free(void*) {}
+
+	// rewinds the arena, if decoding spilled into several blocks they are merged into one large enough for all of it
+	void Reset()
+	{
+		if (blocks.size() > 1)
+		{
+			size_t highWater = 0;
+			for (size_t i = 0; i < blocks.size(); i++)
+			{
+				highWater += blocks[i].used;
+				free(blocks[i].memory);
+			}
+			blocks.clear();
+			addBlock(highWater);
+		}
+		if (!blocks.empty())
+			blocks.back().used = 0;
+		lastAllocation = NULL;
+	}
+
+	~ImageArena()
+	{
+		for (size_t i = 0; i < blocks.size(); i++)
+			free(blocks[i].memory);
+	}
+
+private:
+	struct Block
+	{
+		unsigned char* memory;
+		size_t capacity;
+		size_t used;
+	};
+
+	static const size_t ALIGNMENT = 16;
+	static const size_t HEADER_SIZE = ALIGNMENT;
+	static const size_t MIN_BLOCK_SIZE = 8 * 1024 * 1024;
+
+	ImageArena() : lastAllocation(NULL) {}
+
+	static size_t align(size_t size) { return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1); }
+
+	// false, with nothing added, when malloc fails
+	bool addBlock(size_t needed)
+	{
+		Block block;
+		block.capacity = needed > MIN_BLOCK_SIZE ? needed : MIN_BLOCK_SIZE;
+		block.memory = (unsigned char*)malloc(block.capacity);
+		if (block.memory == NULL)
+			return false;
+		block.used = 0;
+		blocks.push_back(block);
+		return true;
+	}
+
+	std::vector<Block> blocks;
+	void* lastAllocation;
+};
+
+// route stb_image's allocations through the arena; must be seen before stb_image.h is included
+#define STBI_MALLOC(sz) ImageArena::Get().Allocate(sz)
+#define STBI_REALLOC(p, newsz) ImageArena::Get().Reallocate(p, newsz)
+#define STBI_FREE(p) ImageArena::Get().Free(p)
+
+#endif
@@ -0,0 +1,361 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include "frame_arena.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobSystem;
+struct Job;
+
+typedef void (*JobFunction)(JobSystem &jobs, Job &job);
+
+// A unit of work. 'unfinished' counts the job itself plus its children that are still running; a job is done
+// once it drops to zero. Continuations are queued as soon as the job is done, so a frame's tasks can be wired
+// into a dependency graph up front, and they count as children of the job's parent, so waiting for a frame
+// job waits for the whole graph below it.
+struct Job
+{
+	static const int MAX_CONTINUATIONS = 4;
+
+	JobFunction function;
+	void* data;
+	unsigned int begin;
+	unsigned int end;
+	Job* parent;
+	std::atomic<int> unfinished;
+	int continuationCount;
+	Job* continuations[MAX_CONTINUATIONS];
+};
+
+// Chase-Lev work stealing deque: the owning thread pushes and pops at the bottom, other threads steal from
+// the top. Bounded, since a frame never has more than a pool's worth of jobs in flight.
+class WorkStealingQueue
+{
+public:
+	static const long long CAPACITY = 4096;
+
+	WorkStealingQueue() : top(0), bottom(0)
+	{
+		for (long long i = 0; i < CAPACITY; i++)
+			jobs[i].store(NULL, std::memory_order_relaxed);
+	}
+
+	// owner only
+	void Push(Job* job)
+	{
+		long long b = bottom.load(std::memory_order_relaxed);
+		jobs[b & (CAPACITY - 1)].store(job, std::memory_order_relaxed);
+		bottom.store(b + 1, std::memory_order_release);
+	}
+
+	// owner only; newest job first
+	Job* Pop()
+	{
+		long long b = bottom.load(std::memory_order_relaxed) - 1;
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		long long t = top.load(std::memory_order_relaxed);
+		if (t > b)
+		{
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return NULL;
+		}
+		Job* job = jobs[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+		if (t == b)
+		{
+			// last job: race the thieves for it
+			if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				job = NULL;
+			bottom.store(b + 1, std::memory_order_relaxed);
+		}
+		return job;
+	}
+
+	// any thread; oldest job first
+	Job* Steal()
+	{
+		long long t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		long long b = bottom.load(std::memory_order_acquire);
+		if (t >= b)
+			return NULL;
+		Job* job = jobs[t & (CAPACITY - 1)].load(std::memory_order_relaxed);
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			return NULL;
+		return job;
+	}
+
+private:
+	// thieves and the owner each hammer their own end; keep them on separate cache lines
+	std::atomic<long long> top;
+	char padding[64];
+	std::atomic<long long> bottom;
+	std::atomic<Job*> jobs[CAPACITY];
+};
+
+// Work stealing job scheduler for per-frame engine work. Every thread owns a deque and a pool of jobs; a
+// thread runs its own newest jobs first and steals the oldest (largest) ones from others when it runs dry.
+// Nothing on the hot path takes a lock: creating a job bumps a thread local pool index and queues are
+// lock-free. Idle workers sleep on a condition variable that is only signalled when someone is sleeping.
+//
+// Thread 0 is the submitting thread (the one that created the system, or the last to AttachCurrentThread);
+// only it and the workers may create and wait for jobs. Pools are rings that are reused without tracking,
+// so each thread may have at most JOBS_PER_THREAD jobs alive at once, which is plenty for a frame.
+class JobSystem
+{
+public:
+	static const unsigned int JOBS_PER_THREAD = 4096;
+
+	// 'workerCount' threads besides the submitting one; by default one per remaining hardware thread
+	explicit JobSystem(int workerCount = -1) : running(true), sleepers(0)
+	{
+		if (workerCount < 0)
+		{
+			unsigned int hardware = std::thread::hardware_concurrency();
+			workerCount = hardware > 1 ? (int)hardware - 1 : 0;
+		}
+		threads.resize(workerCount + 1);
+		for (size_t i = 0; i < threads.size(); i++)
+		{
+			threads[i].reset(new ThreadState());
+			threads[i]->random = (unsigned int)i * 2654435761u + 1;
+		}
+		currentThread() = 0;
+		for (int i = 1; i <= workerCount; i++)
+			workers.push_back(std::thread(&JobSystem::workerLoop, this, i));
+	}
+
+	~JobSystem()
+	{
+		running.store(false);
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			wake.notify_all();
+		}
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+
+	// makes the calling thread the submitting thread, e.g. a render thread started after the system
+	void AttachCurrentThread()
+	{
+		currentThread() = 0;
+	}
+
+	unsigned int ThreadCount() const
+	{
+		return (unsigned int)threads.size();
+	}
+
+	// a new job from the calling thread's pool; a child keeps its parent unfinished until it is done
+	Job* Create(JobFunction function, void* data = NULL, Job* parent = NULL)
+	{
+		ThreadState &thread = *threads[currentThread()];
+		Job* job = &thread.pool[thread.allocated++ & (JOBS_PER_THREAD - 1)];
+		job->function = function;
+		job->data = data;
+		job->begin = 0;
+		job->end = 0;
+		job->parent = parent;
+		job->unfinished.store(1, std::memory_order_relaxed);
+		job->continuationCount = 0;
+		if (parent)
+			parent->unfinished.fetch_add(1, std::memory_order_relaxed);
+		return job;
+	}
+
+	// queues 'continuation' to run once 'ancestor' is done; call before either job is run, and give a job at
+	// most one ancestor. A continuation without a parent of its own keeps the ancestor's parent unfinished.
+	bool AddContinuation(Job* ancestor, Job* continuation)
+	{
+		if (ancestor->continuationCount == Job::MAX_CONTINUATIONS)
+			return false;
+		ancestor->continuations[ancestor->continuationCount++] = continuation;
+		if (continuation->parent == NULL && ancestor->parent)
+		{
+			continuation->parent = ancestor->parent;
+			continuation->parent->unfinished.fetch_add(1, std::memory_order_relaxed);
+		}
+		return true;
+	}
+
+	void Run(Job* job)
+	{
+		threads[currentThread()]->queue.Push(job);
+		if (sleepers.load(std::memory_order_relaxed) > 0)
+			wake.notify_one();
+	}
+
+	bool IsDone(const Job* job) const
+	{
+		return job->unfinished.load(std::memory_order_acquire) == 0;
+	}
+
+	// runs other jobs until 'job' and all its children are done
+	void Wait(const Job* job)
+	{
+		while (!IsDone(job))
+		{
+			Job* next = findJob(currentThread());
+			if (next)
+				execute(next);
+			else
+				std::this_thread::yield();
+		}
+	}
+
+	// calls body(begin, end) on disjoint sub-ranges of [0, count) of at most 'grain' items, in parallel, and
+	// returns when all are done. The range is split in halves as it is taken, so thieves get the big pieces.
+	template <typename Body>
+	void ParallelFor(unsigned int count, unsigned int grain, const Body &body)
+	{
+		if (count == 0)
+			return;
+		ParallelForData<Body> data;
+		data.body = &body;
+		data.grain = grain > 0 ? grain : 1;
+		Job* root = Create(&parallelForJob<Body>, &data);
+		root->begin = 0;
+		root->end = count;
+		Run(root);
+		Wait(root);
+	}
+
+private:
+	struct ThreadState
+	{
+		ThreadState() : allocated(0), random(1) {}
+
+		WorkStealingQueue queue;
+		Job pool[JOBS_PER_THREAD];
+		unsigned int allocated;
+		unsigned int random;
+	};
+
+	template <typename Body>
+	struct ParallelForData
+	{
+		const Body* body;
+		unsigned int grain;
+	};
+
+	template <typename Body>
+	static void parallelForJob(JobSystem &jobs, Job &job)
+	{
+		const ParallelForData<Body> &data = *(const ParallelForData<Body>*)job.data;
+		unsigned int begin = job.begin, end = job.end;
+		while (end - begin > data.grain)
+		{
+			unsigned int middle = begin + (end - begin) / 2;
+			Job* child = jobs.Create(&parallelForJob<Body>, job.data, &job);
+			child->begin = middle;
+			child->end = end;
+			jobs.Run(child);
+			end = middle;
+		}
+		(*data.body)(begin, end);
+	}
+
+	// index of the calling thread in 'threads'
+	static int& currentThread()
+	{
+		static thread_local int index = 0;
+		return index;
+	}
+
+	Job* findJob(int self)
+	{
+		Job* job = threads[self]->queue.Pop();
+		if (job)
+			return job;
+		size_t count = threads.size();
+		if (count < 2)
+			return NULL;
+		// xorshift, so thieves don't all line up behind the same victim
+		unsigned int &random = threads[self]->random;
+		random ^= random << 13;
+		random ^= random >> 17;
+		random ^= random << 5;
+		size_t start = random % count;
+		for (size_t i = 0; i < count; i++)
+		{
+			size_t victim = (start + i) % count;
+			if ((int)victim == self)
+				continue;
+			job = threads[victim]->queue.Steal();
+			if (job)
+				return job;
+		}
+		return NULL;
+	}
+
+	void execute(Job* job)
+	{
+		// jobs do the frame's work, so what they allocate counts like the render loop's own allocations
+		{
+			HeapAllocations::Scope counted;
+			job->function(*this, *job);
+		}
+		finish(job);
+	}
+
+	void finish(Job* job)
+	{
+		// once the count reaches zero a waiter may return and its thread reuse the slot, so everything needed
+		// afterwards is read first; none of it changes after the job is run
+		Job* parent = job->parent;
+		int continuationCount = job->continuationCount;
+		Job* continuations[Job::MAX_CONTINUATIONS];
+		for (int i = 0; i < continuationCount; i++)
+			continuations[i] = job->continuations[i];
+		if (job->unfinished.fetch_sub(1, std::memory_order_acq_rel) != 1)
+			return;
+		for (int i = 0; i < continuationCount; i++)
+			Run(continuations[i]);
+		if (parent)
+			finish(parent);
+	}
+
+	void workerLoop(int index)
+	{
+		currentThread() = index;
+		int idleRounds = 0;
+		while (running.load(std::memory_order_relaxed))
+		{
+			Job* job = findJob(index);
+			if (job)
+			{
+				execute(job);
+				idleRounds = 0;
+				continue;
+			}
+			// spin briefly so back to back frames keep their workers, then sleep; the timeout covers a
+			// wake-up that raced with going to sleep
+			if (++idleRounds < 256)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			sleepers.fetch_add(1, std::memory_order_relaxed);
+			wake.wait_for(lock, std::chrono::milliseconds(1));
+			sleepers.fetch_sub(1, std::memory_order_relaxed);
+			idleRounds = 0;
+		}
+	}
+
+	std::vector<std::unique_ptr<ThreadState> > threads;
+	std::vector<std::thread> workers;
+	std::atomic<bool> running;
+	std::atomic<int> sleepers;
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+};
+#endif
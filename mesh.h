@@ -8,6 +8,9 @@
 
 #include "shader.h"
 
+#include <cmath>
+#include <cstddef>
+#include <cstring>
 #include <string>
 #include <vector>
 using namespace std;
@@ -25,6 +28,126 @@ struct Vertex {
 	glm::vec3 Bitangent;
 };
 
+// Compact vertex for the generated piece meshes: 16 bytes instead of 8 floats, half the vertex bandwidth.
+// 6.multiple_lights.vs decodes it when PACKED_VERTICES is defined.
+struct PackedVertex {
+	// 16 bit normalized position within the mesh bounds (see PositionQuantization); the fourth short pads
+	short Position[4];
+	// octahedral encoded direction in x and y of a 10:10:10:2 word. The outline "normals" are not unit length
+	// and are lit as they are, so z keeps half the length
+	unsigned int Normal;
+	// half float texCoords
+	unsigned short TexCoords[2];
+};
+static_assert(sizeof(PackedVertex) == 16, "PackedVertex must stay 16 bytes");
+
+// turns packed positions back into model space: position = packed * scale + offset
+struct PositionQuantization {
+	glm::vec3 scale;
+	glm::vec3 offset;
+
+	PositionQuantization() : scale(1.0f), offset(0.0f) {}
+};
+
+// Packs the interleaved vertices the models are generated as (position, normal, texCoords) into PackedVertex.
+class VertexPacker {
+public:
+	// 'stride' is the floats per vertex; returns what the shader needs to unpack the positions
+	static PositionQuantization Pack(const vector<float>& vertices, unsigned int stride, vector<PackedVertex>& packed)
+	{
+		size_t count = stride > 0 ? vertices.size() / stride : 0;
+		glm::vec3 low(0.0f), high(0.0f);
+		for (size_t i = 0; i < count; i++)
+		{
+			glm::vec3 position(vertices[i * stride], vertices[i * stride + 1], vertices[i * stride + 2]);
+			low = i == 0 ? position : glm::min(low, position);
+			high = i == 0 ? position : glm::max(high, position);
+		}
+		PositionQuantization quantization;
+		quantization.offset = (low + high) * 0.5f;
+		quantization.scale = (high - low) * 0.5f;
+
+		packed.resize(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			const float* v = &vertices[i * stride];
+			PackedVertex& vertex = packed[i];
+			for (int c = 0; c < 3; c++)
+			{
+				float extent = quantization.scale[c];
+				vertex.Position[c] = (short)snorm(extent > 0.0f ? (v[c] - quantization.offset[c]) / extent : 0.0f, 32767);
+			}
+			vertex.Position[3] = 0;
+			vertex.Normal = packNormal(glm::vec3(v[3], v[4], v[5]));
+			vertex.TexCoords[0] = packHalf(v[6]);
+			vertex.TexCoords[1] = packHalf(v[7]);
+		}
+		return quantization;
+	}
+
+	// attribute pointers for a bound vertex buffer of PackedVertex, at the locations the float layout used
+	static void SetupAttributes()
+	{
+		glVertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Position));
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Normal));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, TexCoords));
+		glEnableVertexAttribArray(2);
+	}
+
+private:
+	// round to the nearest step of a signed normalized integer with 'steps' steps per unit
+	static int snorm(float value, int steps)
+	{
+		value = value < -1.0f ? -1.0f : (value > 1.0f ? 1.0f : value);
+		return (int)std::floor(value * steps + 0.5f);
+	}
+
+	static unsigned int packNormal(const glm::vec3& normal)
+	{
+		float length = std::sqrt(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+		float sum = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+		float x = 0.0f, y = 0.0f;
+		if (sum > 0.0f)
+		{
+			// project onto the octahedron, then fold the lower half over the upper one
+			x = normal.x / sum;
+			y = normal.y / sum;
+			if (normal.z < 0.0f)
+			{
+				float foldedX = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+				float foldedY = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+				x = foldedX;
+				y = foldedY;
+			}
+		}
+		unsigned int packedX = (unsigned int)snorm(x, 511) & 0x3FF;
+		unsigned int packedY = (unsigned int)snorm(y, 511) & 0x3FF;
+		unsigned int packedLength = (unsigned int)snorm(length * 0.5f, 511) & 0x3FF;
+		return packedX | packedY << 10 | packedLength << 20;
+	}
+
+	// float to half, rounded to nearest; values too small for a normal half become zero
+	static unsigned short packHalf(float value)
+	{
+		unsigned int bits;
+		memcpy(&bits, &value, sizeof(bits));
+		unsigned int sign = (bits >> 16) & 0x8000;
+		int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+		unsigned int mantissa = bits & 0x7FFFFF;
+		if (exponent <= 0)
+			return (unsigned short)sign;
+		if (exponent >= 31)
+			return (unsigned short)(sign | 0x7C00);
+		unsigned int half = sign | (unsigned int)exponent << 10 | mantissa >> 13;
+		// a carry out of the mantissa correctly bumps the exponent
+		if (mantissa & 0x1000)
+			half++;
+		return (unsigned short)half;
+	}
+};
+
 struct Texture {
 	unsigned int id;
 	string type;
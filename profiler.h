@@ -0,0 +1,397 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <glad/glad.h>
+
+#include "shader_manager.h"
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+// Frame profiler. Every named section of the frame is timed on the CPU with a steady clock and on the GPU
+// with a GL_TIME_ELAPSED query, and a GL_PRIMITIVES_GENERATED query counts the triangles of the whole frame
+// (after tessellation, so tessellated and pre-tessellated meshes compare). A GL_SAMPLES_PASSED query counts the
+// fragments that passed the depth test in the stretch between BeginFragmentCount and EndFragmentCount, i.e.
+// the fragments that were shaded there. Queries are double buffered: the results for frame N are read while frame
+// N + 2 begins, and only if the driver already has them, so profiling never stalls the pipeline.
+// Sections are flat (GL_TIME_ELAPSED queries can't nest) and are identified by their name pointer, so pass
+// string literals.
+class Profiler
+{
+public:
+	static const int MAX_SECTIONS = 8;
+	static const int QUERY_BUFFERS = 2;
+	static const int HISTORY = 240;
+
+	struct FrameRecord
+	{
+		double start;                    // seconds since the profiler was created
+		float cpuMs;                     // whole frame on the CPU
+		int sectionCount;
+		unsigned int sectionsBegun;      // bit i is set when section i was begun in this frame
+		int drawCalls;
+		int heapAllocations;
+		long long primitives;            // negative until the query result has arrived
+		long long shadedFragments;       // negative until the query result has arrived, or when nothing was counted
+		unsigned int visibleInstances;
+		unsigned int culledInstances;
+		int binds;                       // made through the GL state cache, and the redundant ones it skipped
+		int skippedBinds;
+		float sectionStart[MAX_SECTIONS]; // CPU start of each section, ms after the frame start
+		float cpuSectionMs[MAX_SECTIONS];
+		float gpuSectionMs[MAX_SECTIONS]; // negative until the query result has arrived
+	};
+
+	Profiler() : frame(0), currentSection(-1), overlayProgram(0), overlayReady(false), overlayVAO(0), overlayVBO(0), fragmentCounting(false), tracing(false)
+	{
+		for (int i = 0; i < QUERY_BUFFERS; i++)
+		{
+			primitiveQueries[i] = 0;
+			fragmentQueries[i] = 0;
+			fragmentsCounted[i] = false;
+		}
+		epoch = std::chrono::steady_clock::now();
+		history.resize(HISTORY);
+	}
+
+	// creates the overlay program and buffers; call once the GL context is current
+	void Init(ShaderManager &shaders)
+	{
+		overlayProgram = shaders.Submit("shaderfiles/profiler_graph.vs", "shaderfiles/profiler_graph.fs");
+		overlayReady = true;
+		glGenQueries(QUERY_BUFFERS, primitiveQueries);
+		glGenQueries(QUERY_BUFFERS, fragmentQueries);
+		glGenVertexArrays(1, &overlayVAO);
+		glGenBuffers(1, &overlayVBO);
+		glBindVertexArray(overlayVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, overlayVBO);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(2 * sizeof(float)));
+		glEnableVertexAttribArray(1);
+		glBindVertexArray(0);
+	}
+
+	// keep every frame (not just the rolling history) for WriteChromeTrace
+	void EnableTrace()
+	{
+		tracing = true;
+	}
+
+	void BeginFrame()
+	{
+		// collect GPU results from the frame that last used this query buffer
+		int buffer = frame % QUERY_BUFFERS;
+		if (frame >= QUERY_BUFFERS)
+		{
+			FrameRecord &old = record(frame - QUERY_BUFFERS);
+			// sections come and go from frame to frame (the shadows only when a map is redrawn); a query that
+			// wasn't begun in that frame has no result, or a stale one
+			for (int i = 0; i < old.sectionCount; i++)
+			{
+				if (!(old.sectionsBegun & (1u << i)))
+					continue;
+				GLuint available = 0;
+				glGetQueryObjectuiv(sections[i].queries[buffer], GL_QUERY_RESULT_AVAILABLE, &available);
+				if (available)
+				{
+					GLuint64 elapsed = 0;
+					glGetQueryObjectui64v(sections[i].queries[buffer], GL_QUERY_RESULT, &elapsed);
+					old.gpuSectionMs[i] = (float)(elapsed / 1.0e6);
+				}
+			}
+			GLuint available = 0;
+			glGetQueryObjectuiv(primitiveQueries[buffer], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available)
+			{
+				GLuint64 primitives = 0;
+				glGetQueryObjectui64v(primitiveQueries[buffer], GL_QUERY_RESULT, &primitives);
+				old.primitives = (long long)primitives;
+			}
+			available = 0;
+			if (fragmentsCounted[buffer])
+				glGetQueryObjectuiv(fragmentQueries[buffer], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available)
+			{
+				GLuint64 fragments = 0;
+				glGetQueryObjectui64v(fragmentQueries[buffer], GL_QUERY_RESULT, &fragments);
+				old.shadedFragments = (long long)fragments;
+			}
+			if (tracing)
+				trace.push_back(old);
+		}
+
+		FrameRecord &current = record(frame);
+		current.start = now();
+		current.cpuMs = 0.0f;
+		current.sectionCount = 0;
+		current.sectionsBegun = 0;
+		current.drawCalls = 0;
+		current.heapAllocations = 0;
+		current.primitives = -1;
+		current.shadedFragments = -1;
+		fragmentsCounted[buffer] = false;
+		current.visibleInstances = 0;
+		current.culledInstances = 0;
+		current.binds = 0;
+		current.skippedBinds = 0;
+		for (int i = 0; i < MAX_SECTIONS; i++)
+		{
+			current.sectionStart[i] = 0.0f;
+			current.cpuSectionMs[i] = 0.0f;
+			current.gpuSectionMs[i] = -1.0f;
+		}
+		if (primitiveQueries[buffer] != 0)
+			glBeginQuery(GL_PRIMITIVES_GENERATED, primitiveQueries[buffer]);
+	}
+
+	void BeginSection(const char* name)
+	{
+		int index = sectionIndex(name);
+		if (index < 0)
+			return;
+		FrameRecord &current = record(frame);
+		if (index + 1 > current.sectionCount)
+			current.sectionCount = index + 1;
+		current.sectionsBegun |= 1u << index;
+		current.sectionStart[index] = (float)((now() - current.start) * 1000.0);
+		glBeginQuery(GL_TIME_ELAPSED, sections[index].queries[frame % QUERY_BUFFERS]);
+		currentSection = index;
+	}
+
+	void EndSection()
+	{
+		if (currentSection < 0)
+			return;
+		glEndQuery(GL_TIME_ELAPSED);
+		FrameRecord &current = record(frame);
+		current.cpuSectionMs[currentSection] = (float)((now() - current.start) * 1000.0) - current.sectionStart[currentSection];
+		currentSection = -1;
+	}
+
+	// counts the fragments drawn from here to EndFragmentCount that pass the depth test; once per frame at most
+	void BeginFragmentCount()
+	{
+		int buffer = frame % QUERY_BUFFERS;
+		if (fragmentQueries[buffer] == 0 || fragmentsCounted[buffer])
+			return;
+		glBeginQuery(GL_SAMPLES_PASSED, fragmentQueries[buffer]);
+		fragmentsCounted[buffer] = true;
+		fragmentCounting = true;
+	}
+
+	void EndFragmentCount()
+	{
+		if (!fragmentCounting)
+			return;
+		glEndQuery(GL_SAMPLES_PASSED);
+		fragmentCounting = false;
+	}
+
+	// call once per glDraw* call
+	void CountDrawCall()
+	{
+		record(frame).drawCalls++;
+	}
+
+	// result of this frame's frustum culling
+	void CountInstances(unsigned int visible, unsigned int culled)
+	{
+		record(frame).visibleInstances = visible;
+		record(frame).culledInstances = culled;
+	}
+
+	// binds of this frame's draws, see GLStateCache
+	void CountBinds(int binds, int skippedBinds)
+	{
+		record(frame).binds = binds;
+		record(frame).skippedBinds = skippedBinds;
+	}
+
+	// heap allocations of the engine's own work this frame (see HeapAllocations); zero once it has warmed up
+	void CountAllocations(int allocations)
+	{
+		record(frame).heapAllocations = allocations;
+	}
+
+	// draw calls made so far in the current frame
+	int DrawCalls() const
+	{
+		return record(frame).drawCalls;
+	}
+
+	void EndFrame()
+	{
+		if (primitiveQueries[frame % QUERY_BUFFERS] != 0)
+			glEndQuery(GL_PRIMITIVES_GENERATED);
+		FrameRecord &current = record(frame);
+		current.cpuMs = (float)((now() - current.start) * 1000.0);
+		frame++;
+	}
+
+	// the most recent frame whose GPU timings are complete
+	const FrameRecord& LastCompleteFrame() const
+	{
+		return history[(frame + HISTORY - QUERY_BUFFERS - 1) % HISTORY];
+	}
+
+	int SectionCount() const
+	{
+		return (int)sections.size();
+	}
+
+	const char* SectionName(int index) const
+	{
+		return sections[index].name;
+	}
+
+	// rolling graph in the lower left corner: one column per frame, GPU time per section stacked in its
+	// colour, scaled so the top of the graph is 33 ms; the bar behind it marks 16.7 ms
+	void DrawOverlay(ShaderManager &shaders)
+	{
+		if (!overlayReady || !shaders.IsReady(overlayProgram))
+			return;
+		static const float colors[MAX_SECTIONS][3] = {
+			{ 0.9f, 0.3f, 0.3f }, { 0.3f, 0.9f, 0.3f }, { 0.3f, 0.5f, 1.0f }, { 1.0f, 0.9f, 0.3f },
+			{ 0.9f, 0.4f, 0.9f }, { 0.3f, 0.9f, 0.9f }, { 1.0f, 0.6f, 0.2f }, { 0.7f, 0.7f, 0.7f }
+		};
+		const float left = -0.98f, bottom = -0.98f, width = 0.9f, height = 0.4f, msScale = height / 33.3f;
+		const float column = width / HISTORY;
+
+		overlayVertices.clear();
+		pushQuad(left, bottom + 16.7f * msScale, width, 0.004f, 0.5f, 0.5f, 0.5f);
+		for (int i = 0; i < HISTORY; i++)
+		{
+			int age = HISTORY - i + QUERY_BUFFERS;
+			if (frame < age)
+				continue;
+			const FrameRecord &r = record(frame - age);
+			float y = bottom;
+			for (int s = 0; s < r.sectionCount; s++)
+			{
+				if (r.gpuSectionMs[s] <= 0.0f)
+					continue;
+				float h = r.gpuSectionMs[s] * msScale;
+				pushQuad(left + i * column, y, column, h, colors[s][0], colors[s][1], colors[s][2]);
+				y += h;
+			}
+		}
+
+		GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+		glDisable(GL_DEPTH_TEST);
+		shaders.Get(overlayProgram).use();
+		glBindVertexArray(overlayVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, overlayVBO);
+		// orphan the previous contents so the driver never waits for last frame's draw
+		glBufferData(GL_ARRAY_BUFFER, overlayVertices.size() * sizeof(float), NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, overlayVertices.size() * sizeof(float), overlayVertices.data());
+		glDrawArrays(GL_TRIANGLES, 0, (GLsizei)(overlayVertices.size() / 5));
+		if (depthTest)
+			glEnable(GL_DEPTH_TEST);
+	}
+
+	// writes the recorded frames in Chrome's trace event format (chrome://tracing, Perfetto). CPU sections are
+	// on thread 1; GPU sections on thread 2, laid end to end from the start of the first section since
+	// GL_TIME_ELAPSED gives durations only
+	bool WriteChromeTrace(const char* path) const
+	{
+		FILE* file = fopen(path, "w");
+		if (file == NULL)
+			return false;
+		fprintf(file, "{\"traceEvents\":[\n");
+		fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n");
+		fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}");
+		for (size_t f = 0; f < trace.size(); f++)
+		{
+			const FrameRecord &r = trace[f];
+			double start = r.start * 1.0e6;
+			fprintf(file, ",\n{\"name\":\"frame\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"draw_calls\":%d,\"allocations\":%d,\"visible\":%u,\"culled\":%u,\"shaded_fragments\":%lld,\"binds\":%d,\"skipped_binds\":%d}}",
+				start, r.cpuMs * 1000.0, r.drawCalls, r.heapAllocations, r.visibleInstances, r.culledInstances, r.shadedFragments, r.binds, r.skippedBinds);
+			double gpuCursor = -1.0;
+			for (int s = 0; s < r.sectionCount; s++)
+			{
+				if (!(r.sectionsBegun & (1u << s)))
+					continue;
+				if (gpuCursor < 0.0)
+					gpuCursor = start + r.sectionStart[s] * 1000.0;
+				fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+					sections[s].name, start + r.sectionStart[s] * 1000.0, r.cpuSectionMs[s] * 1000.0);
+				if (r.gpuSectionMs[s] < 0.0f)
+					continue;
+				fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":1,\"tid\":2,\"ts\":%.3f,\"dur\":%.3f}",
+					sections[s].name, gpuCursor, r.gpuSectionMs[s] * 1000.0);
+				gpuCursor += r.gpuSectionMs[s] * 1000.0;
+			}
+		}
+		fprintf(file, "\n]}\n");
+		fclose(file);
+		return true;
+	}
+
+private:
+	struct Section
+	{
+		const char* name;
+		GLuint queries[QUERY_BUFFERS];
+	};
+
+	double now() const
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - epoch).count();
+	}
+
+	FrameRecord& record(long long index)
+	{
+		return history[index % HISTORY];
+	}
+	const FrameRecord& record(long long index) const
+	{
+		return history[index % HISTORY];
+	}
+
+	int sectionIndex(const char* name)
+	{
+		for (size_t i = 0; i < sections.size(); i++)
+			if (sections[i].name == name)
+				return (int)i;
+		if (sections.size() == MAX_SECTIONS)
+			return -1;
+		Section section;
+		section.name = name;
+		glGenQueries(QUERY_BUFFERS, section.queries);
+		sections.push_back(section);
+		return (int)sections.size() - 1;
+	}
+
+	void pushQuad(float x, float y, float w, float h, float r, float g, float b)
+	{
+		const float corners[6][2] = { { x, y }, { x + w, y }, { x + w, y + h }, { x, y }, { x + w, y + h }, { x, y + h } };
+		for (int i = 0; i < 6; i++)
+		{
+			overlayVertices.push_back(corners[i][0]);
+			overlayVertices.push_back(corners[i][1]);
+			overlayVertices.push_back(r);
+			overlayVertices.push_back(g);
+			overlayVertices.push_back(b);
+		}
+	}
+
+	std::chrono::steady_clock::time_point epoch;
+	long long frame;
+	int currentSection;
+	std::vector<Section> sections;
+	std::vector<FrameRecord> history;
+	ShaderHandle overlayProgram;
+	bool overlayReady;
+	unsigned int overlayVAO, overlayVBO;
+	std::vector<float> overlayVertices;
+	GLuint primitiveQueries[QUERY_BUFFERS];
+	GLuint fragmentQueries[QUERY_BUFFERS];
+	// whether this buffer's fragment query was used in the frame that last had it
+	bool fragmentsCounted[QUERY_BUFFERS];
+	bool fragmentCounting;
+	bool tracing;
+	std::vector<FrameRecord> trace;
+};
+#endif
@@ -0,0 +1,133 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include "scene.h"
+#include "shader.h"
+
+#include <cstdint>
+#include <vector>
+
+// the passes of a frame, in the order they run
+enum RenderPass {
+	PASS_DEPTH,   // depth pre-pass of the opaque surfaces
+	PASS_OPAQUE,  // the lit (or G-buffer, or overdraw) surfaces
+	PASS_LAMPS,   // light cubes, after deferred lighting
+	RENDER_PASSES
+};
+
+// one draw: an instance with its own model matrix, or an instanced batch whose transforms are in the instance
+// buffer
+struct RenderCommand
+{
+	RenderPass pass;
+	Shader* shader;
+	SceneMaterial material;
+	const SceneMesh* mesh;
+	const SceneLod* lod;
+	const SceneInstance* instance; // NULL for a batch
+	const SceneBatch* batch;       // NULL for an instance
+};
+
+// The draws of a frame, submitted in any order with a 64 bit sort key and executed in key order. Two layouts,
+// from the high bits down:
+//   StateKey   pass 4 | program 8 | material 4 | mesh 16 | depth 32
+//   DepthKey   pass 4 | depth 32 | program 8 | material 4 | mesh 16
+// The state key puts draws that share a program, textures and vertex array next to each other; the depth key
+// draws front to back first and only groups equal depths by state. 'mesh' is the mesh index and level of detail,
+// 'depth' a rank (the position in the sorted draw list), which also keeps the order stable from frame to frame.
+//
+// Sort() is a least significant digit radix sort on bytes of the key: one pass counts all eight digits, and a
+// digit every key shares (the high bytes of the depth rank, the unused bits of the mesh) is skipped. Its buffers
+// are kept between frames, so a warmed up queue doesn't allocate.
+class RenderQueue
+{
+public:
+	static const int PASS_SHIFT = 60;
+
+	// empties the queue and forgets the program slots
+	void Clear()
+	{
+		commands.clear();
+		entries.clear();
+		programs.clear();
+	}
+
+	void Submit(uint64_t key, const RenderCommand& command)
+	{
+		Entry entry;
+		entry.key = key;
+		entry.command = (unsigned int)commands.size();
+		entries.push_back(entry);
+		commands.push_back(command);
+	}
+
+	// small number for a program, given out in the order the programs are first asked for this frame
+	unsigned int ProgramSlot(const Shader* shader)
+	{
+		for (size_t i = 0; i < programs.size(); i++)
+			if (programs[i] == shader)
+				return (unsigned int)i;
+		programs.push_back(shader);
+		return (unsigned int)(programs.size() - 1);
+	}
+
+	static uint64_t StateKey(RenderPass pass, unsigned int program, SceneMaterial material, unsigned int mesh, unsigned int lod, unsigned int depth)
+	{
+		return ((uint64_t)pass << PASS_SHIFT) | ((uint64_t)(program & 0xFF) << 52) | ((uint64_t)(material & 0xF) << 48)
+			| ((uint64_t)meshBits(mesh, lod) << 32) | depth;
+	}
+
+	static uint64_t DepthKey(RenderPass pass, unsigned int program, SceneMaterial material, unsigned int mesh, unsigned int lod, unsigned int depth)
+	{
+		return ((uint64_t)pass << PASS_SHIFT) | ((uint64_t)depth << 28) | ((uint64_t)(program & 0xFF) << 20)
+			| ((uint64_t)(material & 0xF) << 16) | meshBits(mesh, lod);
+	}
+
+	// orders the commands by key; equal keys keep their submission order
+	void Sort()
+	{
+		scratch.resize(entries.size());
+		unsigned int counts[8][256] = {};
+		for (size_t i = 0; i < entries.size(); i++)
+			for (int digit = 0; digit < 8; digit++)
+				counts[digit][(entries[i].key >> (digit * 8)) & 0xFF]++;
+		for (int digit = 0; digit < 8; digit++)
+		{
+			const unsigned int* count = counts[digit];
+			if (entries.empty() || count[(entries[0].key >> (digit * 8)) & 0xFF] == entries.size())
+				continue;
+			unsigned int offsets[256];
+			unsigned int offset = 0;
+			for (int bucket = 0; bucket < 256; bucket++)
+			{
+				offsets[bucket] = offset;
+				offset += count[bucket];
+			}
+			for (size_t i = 0; i < entries.size(); i++)
+				scratch[offsets[(entries[i].key >> (digit * 8)) & 0xFF]++] = entries[i];
+			entries.swap(scratch);
+		}
+	}
+
+	size_t Size() const { return entries.size(); }
+	// the i-th command in key order, once sorted
+	const RenderCommand& Sorted(size_t i) const { return commands[entries[i].command]; }
+
+private:
+	struct Entry
+	{
+		uint64_t key;
+		unsigned int command;
+	};
+
+	static unsigned int meshBits(unsigned int mesh, unsigned int lod)
+	{
+		return ((mesh & 0xFF) << 8) | (lod & 0xFF);
+	}
+
+	std::vector<RenderCommand> commands;
+	std::vector<Entry> entries;
+	std::vector<Entry> scratch;
+	std::vector<const Shader*> programs;
+};
+#endif
@@ -0,0 +1,511 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "culling.h"
+#include "job_system.h"
+#include "mesh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+// what a scene instance is shaded with; the lit materials index the texture tables in main()
+enum SceneMaterial {
+	MATERIAL_BLACK,
+	MATERIAL_WHITE,
+	MATERIAL_CHECKER,
+	MATERIAL_LIGHT
+};
+
+// one tessellation of a mesh: a vertex array set up by LoadModel (indexed, GL_UNSIGNED_SHORT, packed vertices
+// that 'quantization' unpacks) or a plain triangle list; 'slices' is the number of lathe slices, 0 for models
+// that are not lathed
+struct SceneLod
+{
+	unsigned int VAO;
+	GLsizei count;
+	unsigned int slices;
+	PositionQuantization quantization;
+};
+
+// a mesh, its bounds, and its levels of detail from coarsest to finest
+struct SceneMesh
+{
+	bool indexed;
+	AABB box;
+	BoundingSphere bounds;
+	// distance of the outline from the lathe axis, what the slice count has to approximate
+	float latheRadius;
+	// buffer texture with the outline when the shaders lathe the mesh themselves (--gpu-lathe, --tessellate),
+	// else 0
+	unsigned int latheOutline;
+	// GL_TRIANGLES, or GL_PATCHES for a coarse lathe the tessellation stages refine (--tessellate)
+	GLenum primitive;
+	std::vector<SceneLod> lods;
+};
+
+struct SceneInstance
+{
+	unsigned int mesh;
+	SceneMaterial material;
+	glm::mat4 model;
+	// level of detail currently drawn, kept between frames for hysteresis
+	unsigned int lod;
+	bool lodChosen;
+};
+
+// an instance whose transform changed, with its world space bounds before and after
+struct SceneMove
+{
+	unsigned int instance;
+	BoundingSphere from;
+	BoundingSphere to;
+};
+
+// visible instances that share material, mesh and level of detail; their model matrices are the 'count'
+// consecutive entries of the transform array starting at 'first'
+struct SceneBatch
+{
+	SceneMaterial material;
+	unsigned int mesh;
+	unsigned int lod;
+	unsigned int first;
+	unsigned int count;
+	// position of its last instance in the draw list
+	unsigned int drawOrder;
+};
+
+// what a view other than the camera's sees (a shadow map): the visible instances and the level of detail each
+// of them is drawn at, by draw list position. The camera's own draw list and levels live in the Scene
+struct SceneView
+{
+	std::vector<unsigned int> drawList;
+	std::vector<unsigned int> lods;
+};
+
+// Everything that gets drawn, as data: meshes, instances of them and the world space bounding sphere of each
+// instance. Cull() tests all instances against the view frustum and rebuilds the draw list, which keeps the
+// order the instances were added in; SortFrontToBack() then reorders it for the camera, so the depth test
+// rejects hidden surfaces before they are shaded.
+//
+// Lathed meshes can carry several tessellations. SelectLods() picks one per visible instance so the lathe
+// polygon stays within LOD_ERROR_PIXELS of the true circle on screen; an instance only steps down to a coarser
+// level once that level is comfortably inside the limit (LOD_HYSTERESIS), so nothing pops back and forth
+// while the camera moves slowly. Other views (the shadow maps) cull and pick levels into a SceneView of their
+// own, without hysteresis, and leave the camera's choices alone.
+//
+// For large scenes BuildBatches() groups the draw list into instanced batches: the model matrices of each
+// batch are packed back to back so they can be streamed into one vertex buffer and read as a per instance
+// attribute (locations 3 to 6, see EnableInstancing).
+//
+// Instances are static unless SetTransform() moves them; every move is kept until ClearMoves(), so whatever
+// caches the static scene (the shadow maps) can tell which part of it is out of date.
+class Scene
+{
+public:
+	static constexpr float LOD_ERROR_PIXELS = 1.0f;
+	static constexpr float LOD_HYSTERESIS = 0.75f;
+	// work per job when a job system is passed in: blocks of four spheres to cull, instances to pick LODs for
+	static const unsigned int CULL_GRAIN = 64;
+	static const unsigned int LOD_GRAIN = 256;
+
+	Scene()
+	{
+		stats.visible = 0;
+		stats.culled = 0;
+	}
+
+	// 'vertices' is the interleaved data the VAO was built from, 'stride' its floats per vertex
+	unsigned int AddMesh(unsigned int VAO, GLsizei count, bool indexed, const PositionQuantization& quantization, const std::vector<float>& vertices, unsigned int stride, unsigned int slices = 0)
+	{
+		SceneMesh mesh;
+		mesh.indexed = indexed;
+		ComputeBounds(vertices, stride, mesh.box, mesh.bounds);
+		float radiusX = mesh.box.max.x > -mesh.box.min.x ? mesh.box.max.x : -mesh.box.min.x;
+		float radiusZ = mesh.box.max.z > -mesh.box.min.z ? mesh.box.max.z : -mesh.box.min.z;
+		mesh.latheRadius = radiusX > radiusZ ? radiusX : radiusZ;
+		mesh.latheOutline = 0;
+		mesh.primitive = GL_TRIANGLES;
+		meshes.push_back(mesh);
+		AddLod((unsigned int)(meshes.size() - 1), VAO, count, quantization, slices);
+		return (unsigned int)(meshes.size() - 1);
+	}
+
+	// another tessellation of a lathed mesh, built from the same outline
+	void AddLod(unsigned int mesh, unsigned int VAO, GLsizei count, const PositionQuantization& quantization, unsigned int slices)
+	{
+		SceneLod lod;
+		lod.VAO = VAO;
+		lod.count = count;
+		lod.slices = slices;
+		lod.quantization = quantization;
+		std::vector<SceneLod>& lods = meshes[mesh].lods;
+		size_t position = 0;
+		while (position < lods.size() && lods[position].slices < slices)
+			position++;
+		lods.insert(lods.begin() + position, lod);
+	}
+
+	void SetLatheOutline(unsigned int mesh, unsigned int texture)
+	{
+		meshes[mesh].latheOutline = texture;
+	}
+
+	// what the draw calls of a mesh assemble; patches take their size from GL_PATCH_VERTICES
+	void SetPrimitive(unsigned int mesh, GLenum primitive)
+	{
+		meshes[mesh].primitive = primitive;
+	}
+
+	void AddInstance(unsigned int mesh, SceneMaterial material, const glm::mat4& model)
+	{
+		SceneInstance instance;
+		instance.mesh = mesh;
+		instance.material = material;
+		instance.model = model;
+		instance.lod = 0;
+		instance.lodChosen = false;
+		instances.push_back(instance);
+		spheres.Add(TransformSphere(meshes[mesh].bounds, model));
+	}
+
+	// moves an instance and records the move (see Moves)
+	void SetTransform(unsigned int index, const glm::mat4& model)
+	{
+		SceneInstance& instance = instances[index];
+		SceneMove move;
+		move.instance = index;
+		move.from = TransformSphere(meshes[instance.mesh].bounds, instance.model);
+		instance.model = model;
+		move.to = TransformSphere(meshes[instance.mesh].bounds, model);
+		spheres.Set(index, move.to);
+		moves.push_back(move);
+	}
+
+	// the moves since the last ClearMoves(), in the order they happened
+	const std::vector<SceneMove>& Moves() const { return moves; }
+	void ClearMoves() { moves.clear(); }
+
+	// world space box around every instance of a material
+	AABB MaterialBounds(SceneMaterial material) const
+	{
+		AABB bounds;
+		bounds.min = glm::vec3(0.0f);
+		bounds.max = glm::vec3(0.0f);
+		bool empty = true;
+		for (size_t i = 0; i < instances.size(); i++)
+		{
+			if (instances[i].material != material)
+				continue;
+			const AABB& box = meshes[instances[i].mesh].box;
+			for (int corner = 0; corner < 8; corner++)
+			{
+				glm::vec3 point((corner & 1) ? box.max.x : box.min.x, (corner & 2) ? box.max.y : box.min.y, (corner & 4) ? box.max.z : box.min.z);
+				glm::vec3 world = glm::vec3(instances[i].model * glm::vec4(point, 1.0f));
+				bounds.min = empty ? world : glm::min(bounds.min, world);
+				bounds.max = empty ? world : glm::max(bounds.max, world);
+				empty = false;
+			}
+		}
+		return bounds;
+	}
+
+	// culls against the camera frustum and rebuilds the draw list; with a job system the spheres are tested
+	// in parallel
+	void Cull(const Frustum& frustum, JobSystem* jobs = NULL)
+	{
+		size_t visibleCount = cull(frustum, drawList, jobs);
+		stats.visible = (unsigned int)visibleCount;
+		stats.culled = (unsigned int)(instances.size() - visibleCount);
+	}
+
+	// the same for another view; the camera's draw list and statistics stay as they are
+	void Cull(const Frustum& frustum, SceneView& view, JobSystem* jobs = NULL)
+	{
+		cull(frustum, view.drawList, jobs);
+	}
+
+	// orders the draw list front to back for a camera at 'eye' looking along 'forward'; call after Cull(). An
+	// instance goes by the far side of its bounding sphere: a large instance that smaller ones stand on (the
+	// board under its pieces) lies behind them wherever they overlap and is drawn after them. The lamps go last,
+	// in the order they were added
+	void SortFrontToBack(const glm::vec3& eye, const glm::vec3& forward)
+	{
+		depthOrder.resize(drawList.size());
+		for (size_t i = 0; i < drawList.size(); i++)
+		{
+			BoundingSphere sphere = spheres.Get(drawList[i]);
+			depthOrder[i].depth = instances[drawList[i]].material == MATERIAL_LIGHT ? FLT_MAX : glm::dot(sphere.center - eye, forward) + sphere.radius;
+			depthOrder[i].instance = drawList[i];
+		}
+		std::sort(depthOrder.begin(), depthOrder.end());
+		for (size_t i = 0; i < drawList.size(); i++)
+			drawList[i] = depthOrder[i].instance;
+	}
+
+	// picks the level of detail of every instance in the draw list; call after Cull(). Instances are
+	// independent, so with a job system they are split across threads
+	void SelectLods(const glm::mat4& projection, const glm::mat4& view, float viewportHeight, JobSystem* jobs = NULL)
+	{
+		// pixels per world unit at view depth 1 (perspective) or at any depth (orthographic)
+		float pixelScale = projection[1][1] * viewportHeight * 0.5f;
+		auto select = [&](unsigned int begin, unsigned int end)
+		{
+			for (unsigned int i = begin; i < end; i++)
+			{
+				SceneInstance& instance = instances[drawList[i]];
+				instance.lod = chooseLod(instance, projection, view, pixelScale, instance.lodChosen ? instance.lod : 0);
+				instance.lodChosen = true;
+			}
+		};
+		if (jobs)
+			jobs->ParallelFor((unsigned int)drawList.size(), LOD_GRAIN, select);
+		else
+			select(0, (unsigned int)drawList.size());
+	}
+
+	// the same for another view, after Cull() into it. Nothing is kept between calls, so there is no
+	// hysteresis: every level is chosen afresh, from the coarsest up
+	void SelectLods(const glm::mat4& projection, const glm::mat4& viewMatrix, float viewportHeight, SceneView& view, JobSystem* jobs = NULL)
+	{
+		float pixelScale = projection[1][1] * viewportHeight * 0.5f;
+		view.lods.resize(view.drawList.size());
+		auto select = [&](unsigned int begin, unsigned int end)
+		{
+			for (unsigned int i = begin; i < end; i++)
+				view.lods[i] = chooseLod(instances[view.drawList[i]], projection, viewMatrix, pixelScale, 0);
+		};
+		if (jobs)
+			jobs->ParallelFor((unsigned int)view.drawList.size(), LOD_GRAIN, select);
+		else
+			select(0, (unsigned int)view.drawList.size());
+	}
+
+	// the tessellation an instance is drawn with, and its index in the mesh's levels of detail
+	const SceneLod& Lod(const SceneInstance& instance) const
+	{
+		return meshes[instance.mesh].lods[LodIndex(instance)];
+	}
+
+	unsigned int LodIndex(const SceneInstance& instance) const
+	{
+		return instance.lodChosen ? instance.lod : (unsigned int)meshes[instance.mesh].lods.size() - 1;
+	}
+
+	// issues the draw call for one instance, at the camera's level of detail or at 'lod'; the caller binds the
+	// VAO and sets the model matrix
+	void Draw(const SceneInstance& instance) const
+	{
+		Draw(instance, Lod(instance));
+	}
+
+	void Draw(const SceneInstance& instance, const SceneLod& lod) const
+	{
+		const SceneMesh& mesh = meshes[instance.mesh];
+		if (mesh.indexed)
+			glDrawElements(mesh.primitive, lod.count, GL_UNSIGNED_SHORT, NULL);
+		else
+			glDrawArrays(mesh.primitive, 0, lod.count);
+	}
+
+	// groups the draw list by material, then mesh, then level of detail (a counting sort, so the work is
+	// linear in the number of visible instances) and packs the model matrices in batch order; the outputs are
+	// sized exactly, so they can live in a frame arena
+	template <typename BatchAllocator, typename TransformAllocator>
+	void BuildBatches(std::vector<SceneBatch, BatchAllocator>& batches, std::vector<glm::mat4, TransformAllocator>& transforms)
+	{
+		buildBatches(drawList, [&](size_t i) { return LodIndex(instances[drawList[i]]); }, batches, transforms);
+	}
+
+	// the same for another view, after Cull() and SelectLods() into it
+	template <typename BatchAllocator, typename TransformAllocator>
+	void BuildBatches(const SceneView& view, std::vector<SceneBatch, BatchAllocator>& batches, std::vector<glm::mat4, TransformAllocator>& transforms)
+	{
+		buildBatches(view.drawList, [&](size_t i) { return view.lods[i]; }, batches, transforms);
+	}
+
+	// adds the per instance model matrix (locations 3 to 6, one column each) to every vertex array of the
+	// scene; the matrices come from 'instanceBuffer'
+	void EnableInstancing(unsigned int instanceBuffer)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			for (size_t j = 0; j < meshes[i].lods.size(); j++)
+			{
+				glBindVertexArray(meshes[i].lods[j].VAO);
+				for (unsigned int column = 0; column < 4; column++)
+				{
+					glEnableVertexAttribArray(3 + column);
+					glVertexAttribDivisor(3 + column, 1);
+				}
+				pointInstances(0);
+			}
+		}
+		glBindVertexArray(0);
+	}
+
+	// draws one batch with the instance buffer (bound to GL_ARRAY_BUFFER) holding the transforms from
+	// BuildBatches; the caller binds the batch's VAO. There is no base instance before GL 4.2, so the
+	// instance attributes are pointed at the batch instead.
+	void DrawBatch(const SceneBatch& batch) const
+	{
+		pointInstances(batch.first);
+		const SceneMesh& mesh = meshes[batch.mesh];
+		const SceneLod& lod = mesh.lods[batch.lod];
+		if (mesh.indexed)
+			glDrawElementsInstanced(mesh.primitive, lod.count, GL_UNSIGNED_SHORT, NULL, batch.count);
+		else
+			glDrawArraysInstanced(mesh.primitive, 0, lod.count, batch.count);
+	}
+
+	const SceneMesh& Mesh(unsigned int index) const { return meshes[index]; }
+	const SceneInstance& Instance(unsigned int index) const { return instances[index]; }
+	// indices of the visible instances, in the order they were added or as SortFrontToBack() left them
+	const std::vector<unsigned int>& DrawList() const { return drawList; }
+	const CullStats& Stats() const { return stats; }
+
+private:
+	// sort entry of SortFrontToBack, ties broken by instance so the order is the same every frame
+	struct DepthOrder
+	{
+		float depth;
+		unsigned int instance;
+
+		bool operator<(const DepthOrder& other) const
+		{
+			return depth < other.depth || (depth == other.depth && instance < other.instance);
+		}
+	};
+
+	// largest distance between the lathe polygon and the circle it approximates (the sagitta), in pixels
+	static float latheError(float radiusPixels, unsigned int slices)
+	{
+		return radiusPixels * (1.0f - std::cos(3.14159265f / slices));
+	}
+
+	// rebuilds 'list' with the instances inside the frustum, in the order they were added; returns their number
+	size_t cull(const Frustum& frustum, std::vector<unsigned int>& list, JobSystem* jobs)
+	{
+		size_t visibleCount = 0;
+		if (jobs)
+		{
+			visible.resize(spheres.Blocks() * 4);
+			std::atomic<size_t> counted(0);
+			jobs->ParallelFor((unsigned int)spheres.Blocks(), CULL_GRAIN, [&](unsigned int begin, unsigned int end)
+			{
+				counted.fetch_add(spheres.CullBlocks(frustum, visible, begin, end), std::memory_order_relaxed);
+			});
+			visibleCount = counted.load();
+		}
+		else
+			visibleCount = spheres.Cull(frustum, visible);
+		list.clear();
+		for (size_t i = 0; i < instances.size(); i++)
+			if (visible[i])
+				list.push_back((unsigned int)i);
+		return visibleCount;
+	}
+
+	// the level of detail of an instance for a view, moving from 'lod' (the last choice, or 0) as far as it must
+	unsigned int chooseLod(const SceneInstance& instance, const glm::mat4& projection, const glm::mat4& view, float pixelScale, unsigned int lod) const
+	{
+		const SceneMesh& mesh = meshes[instance.mesh];
+		if (mesh.lods.size() < 2)
+			return 0;
+		glm::vec4 center = projection * (view * (instance.model * glm::vec4(mesh.bounds.center, 1.0f)));
+		// clip w is the view depth for a perspective projection and 1 for an orthographic one
+		float depth = center.w > 0.01f ? center.w : 0.01f;
+		float radiusPixels = mesh.latheRadius * scaleOf(instance.model) * pixelScale / depth;
+
+		while (lod + 1 < mesh.lods.size() && latheError(radiusPixels, mesh.lods[lod].slices) > LOD_ERROR_PIXELS)
+			lod++;
+		while (lod > 0 && latheError(radiusPixels, mesh.lods[lod - 1].slices) < LOD_ERROR_PIXELS * LOD_HYSTERESIS)
+			lod--;
+		return lod;
+	}
+
+	static float scaleOf(const glm::mat4& model)
+	{
+		return glm::length(glm::vec3(model[0]));
+	}
+
+	static void pointInstances(unsigned int first)
+	{
+		for (unsigned int column = 0; column < 4; column++)
+			glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(first * sizeof(glm::mat4) + column * sizeof(glm::vec4)));
+	}
+
+	size_t batchKey(const SceneInstance& instance, unsigned int lod, size_t maxLods) const
+	{
+		return ((size_t)instance.material * meshes.size() + instance.mesh) * maxLods + lod;
+	}
+
+	// BuildBatches() for any draw list; lodOf(i) is the level of detail of its i-th entry
+	template <typename LodOf, typename BatchAllocator, typename TransformAllocator>
+	void buildBatches(const std::vector<unsigned int>& list, const LodOf& lodOf, std::vector<SceneBatch, BatchAllocator>& batches,
+		std::vector<glm::mat4, TransformAllocator>& transforms)
+	{
+		size_t maxLods = 1;
+		for (size_t i = 0; i < meshes.size(); i++)
+			maxLods = meshes[i].lods.size() > maxLods ? meshes[i].lods.size() : maxLods;
+		size_t keyCount = (MATERIAL_LIGHT + 1) * meshes.size() * maxLods;
+		batchCounts.assign(keyCount, 0);
+		batchOrders.resize(keyCount);
+		for (size_t i = 0; i < list.size(); i++)
+		{
+			size_t key = batchKey(instances[list[i]], lodOf(i), maxLods);
+			batchCounts[key]++;
+			batchOrders[key] = (unsigned int)i;
+		}
+
+		size_t batchCount = 0;
+		for (size_t key = 0; key < keyCount; key++)
+			batchCount += batchCounts[key] > 0 ? 1 : 0;
+		batches.clear();
+		batches.reserve(batchCount);
+		batchStarts.assign(keyCount, 0);
+		unsigned int first = 0;
+		for (size_t key = 0; key < keyCount; key++)
+		{
+			batchStarts[key] = first;
+			if (batchCounts[key] == 0)
+				continue;
+			SceneBatch batch;
+			batch.lod = (unsigned int)(key % maxLods);
+			batch.mesh = (unsigned int)((key / maxLods) % meshes.size());
+			batch.material = (SceneMaterial)(key / maxLods / meshes.size());
+			batch.first = first;
+			batch.count = batchCounts[key];
+			batch.drawOrder = batchOrders[key];
+			batches.push_back(batch);
+			first += batchCounts[key];
+		}
+
+		transforms.resize(list.size());
+		for (size_t i = 0; i < list.size(); i++)
+		{
+			const SceneInstance& instance = instances[list[i]];
+			transforms[batchStarts[batchKey(instance, lodOf(i), maxLods)]++] = instance.model;
+		}
+	}
+
+	std::vector<SceneMesh> meshes;
+	std::vector<SceneInstance> instances;
+	SphereSet spheres;
+	std::vector<unsigned char> visible;
+	std::vector<unsigned int> drawList;
+	std::vector<unsigned int> batchCounts;
+	std::vector<unsigned int> batchStarts;
+	std::vector<unsigned int> batchOrders;
+	std::vector<DepthOrder> depthOrder;
+	std::vector<SceneMove> moves;
+	CullStats stats;
+};
+#endif
@@ -6,96 +6,229 @@
 #include <glm/glm.hpp>
 
 #include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <mutex>
+#include <algorithm>
 #include <fstream>
-#include <sstream>
 #include <iostream>
+#include <cstdio>
 
-class Shader
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// fixed binding points of the uniform blocks shared by all programs (GLSL 330 has no layout(binding))
+const GLuint CAMERA_BLOCK_BINDING = 0;
+
+// Every shader file is read from disk once, with a single read into a buffer sized from the file length,
+// and shared by all permutations and #includes that use it.
+class ShaderSources
 {
 public:
-	unsigned int ID;
-	// constructor generates the shader on the fly
-	// ------------------------------------------------------------------------
-	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+	// copies the file's contents into 'out', returns false when the file can't be read. Safe to call from the
+	// hot reload thread
+	static bool Get(const std::string &path, std::string &out)
 	{
-		// 1. retrieve the vertex/fragment source code from filePath
-		std::string vertexCode;
-		std::string fragmentCode;
-		std::string geometryCode;
-		std::ifstream vShaderFile;
-		std::ifstream fShaderFile;
-		std::ifstream gShaderFile;
-		// ensure ifstream objects can throw exceptions:
-		vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-		fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-		gShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-		try
+		std::lock_guard<std::mutex> lock(mutex());
+		std::map<std::string, std::string> &files = cache();
+		std::map<std::string, std::string>::iterator it = files.find(path);
+		if (it == files.end())
 		{
-			// open files
-			vShaderFile.open(vertexPath);
-			fShaderFile.open(fragmentPath);
-			std::stringstream vShaderStream, fShaderStream;
-			// read file's buffer contents into streams
-			vShaderStream << vShaderFile.rdbuf();
-			fShaderStream << fShaderFile.rdbuf();
-			// close file handlers
-			vShaderFile.close();
-			fShaderFile.close();
-			// convert stream into string
-			vertexCode = vShaderStream.str();
-			fragmentCode = fShaderStream.str();
-			// if geometry shader path is present, also load a geometry shader
-			if (geometryPath != nullptr)
-			{
-				gShaderFile.open(geometryPath);
-				std::stringstream gShaderStream;
-				gShaderStream << gShaderFile.rdbuf();
-				gShaderFile.close();
-				geometryCode = gShaderStream.str();
-			}
+			std::string contents;
+			if (!readFile(path, contents))
+				return false;
+			it = files.insert(std::make_pair(path, std::string())).first;
+			it->second.swap(contents);
 		}
-		catch (std::ifstream::failure& e)
+		out = it->second;
+		return true;
+	}
+	// forgets a file so the next Get() reads it from disk again
+	static void Invalidate(const std::string &path)
+	{
+		std::lock_guard<std::mutex> lock(mutex());
+		cache().erase(path);
+	}
+	static bool readFile(const std::string &path, std::string &out)
+	{
+		std::ifstream file(path.c_str(), std::ios::binary | std::ios::ate);
+		if (!file.is_open())
+			return false;
+		std::streamoff size = file.tellg();
+		if (size < 0)
+			return false;
+		out.resize((size_t)size);
+		file.seekg(0);
+		if (size > 0)
+			file.read(&out[0], size);
+		return !file.fail();
+	}
+
+private:
+	static std::map<std::string, std::string>& cache()
+	{
+		static std::map<std::string, std::string> files;
+		return files;
+	}
+	static std::mutex& mutex()
+	{
+		static std::mutex cacheMutex;
+		return cacheMutex;
+	}
+};
+
+// A uniform name, reduced to its 64 bit FNV-1a hash as it is passed in. Setters take it directly from string
+// literals, so setting a uniform never builds a std::string or touches the heap.
+struct UniformName
+{
+	unsigned long long Hash;
+
+	UniformName(const char* name) : Hash(hash(name)) {}
+	UniformName(const std::string &name) : Hash(hash(name.c_str())) {}
+
+private:
+	static unsigned long long hash(const char* name)
+	{
+		unsigned long long value = 14695981039346656037ULL;
+		for (; *name; name++)
 		{
-			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+			value ^= (unsigned char)*name;
+			value *= 1099511628211ULL;
 		}
-		const char* vShaderCode = vertexCode.c_str();
-		const char * fShaderCode = fragmentCode.c_str();
-		// 2. compile shaders
-		unsigned int vertex, fragment;
-		// vertex shader
-		vertex = glCreateShader(GL_VERTEX_SHADER);
-		glShaderSource(vertex, 1, &vShaderCode, NULL);
-		glCompileShader(vertex);
-		checkCompileErrors(vertex, "VERTEX");
-		// fragment Shader
-		fragment = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(fragment, 1, &fShaderCode, NULL);
-		glCompileShader(fragment);
-		checkCompileErrors(fragment, "FRAGMENT");
-		// if geometry shader is given, compile geometry shader
-		unsigned int geometry;
+		return value;
+	}
+};
+
+// compile time switches for a shader permutation, each entry becomes a "#define <entry>" line right after
+// #version, e.g. "SPOT_LIGHT" or "NR_POINT_LIGHTS 4"
+typedef std::vector<std::string> ShaderDefines;
+
+class Shader
+{
+public:
+	unsigned int ID;
+	// identifies the set of defines this program was built with; equal defines give equal keys
+	unsigned long long PermutationKey;
+	// every file the program was built from, #includes included; used to find programs to hot reload
+	std::vector<std::string> SourceFiles;
+	// constructor generates the shader on the fly. With async set the compile and link are only submitted,
+	// call IsReady() until it returns true before using the program. The tessellation stages need GL 4.0
+	// ------------------------------------------------------------------------
+	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr, const ShaderDefines &defines = ShaderDefines(), bool async = false,
+		const char* tessControlPath = nullptr, const char* tessEvaluationPath = nullptr)
+		: ID(0), PermutationKey(permutationKey(defines)), vertex(0), fragment(0), geometry(0), tessControl(0), tessEvaluation(0), ready(false), linked(false)
+	{
+		// 1. retrieve the vertex/fragment source code from filePath, with #includes expanded and the
+		// permutation defines injected
+		std::string vertexCode = loadSource(vertexPath, defines);
+		std::string fragmentCode = loadSource(fragmentPath, defines);
+		std::string geometryCode;
 		if (geometryPath != nullptr)
+			geometryCode = loadSource(geometryPath, defines);
+		std::string tessControlCode, tessEvaluationCode;
+		if (tessControlPath != nullptr)
+			tessControlCode = loadSource(tessControlPath, defines);
+		if (tessEvaluationPath != nullptr)
+			tessEvaluationCode = loadSource(tessEvaluationPath, defines);
+		// 2. try the program binary cache, keyed by the sources and the driver that built the binary
+		cacheFile = binaryCachePath(vertexCode, fragmentCode, geometryCode, tessControlCode + tessEvaluationCode);
+		if (loadProgramBinary(cacheFile))
 		{
-			const char * gShaderCode = geometryCode.c_str();
-			geometry = glCreateShader(GL_GEOMETRY_SHADER);
-			glShaderSource(geometry, 1, &gShaderCode, NULL);
-			glCompileShader(geometry);
-			checkCompileErrors(geometry, "GEOMETRY");
+			ready = true;
+			linked = true;
+			return;
 		}
+		// 3. hand all stages and the link to the driver without asking for any status in between, so a
+		// driver that compiles in the background is never forced to finish early
+		vertex = submitStage(GL_VERTEX_SHADER, vertexCode);
+		fragment = submitStage(GL_FRAGMENT_SHADER, fragmentCode);
+		if (geometryPath != nullptr)
+			geometry = submitStage(GL_GEOMETRY_SHADER, geometryCode);
+		if (tessControlPath != nullptr)
+			tessControl = submitStage(GL_TESS_CONTROL_SHADER, tessControlCode);
+		if (tessEvaluationPath != nullptr)
+			tessEvaluation = submitStage(GL_TESS_EVALUATION_SHADER, tessEvaluationCode);
 		// shader Program
 		ID = glCreateProgram();
 		glAttachShader(ID, vertex);
 		glAttachShader(ID, fragment);
-		if (geometryPath != nullptr)
+		if (geometry != 0)
 			glAttachShader(ID, geometry);
+		if (tessControl != 0)
+			glAttachShader(ID, tessControl);
+		if (tessEvaluation != 0)
+			glAttachShader(ID, tessEvaluation);
+		if (programBinarySupported())
+			glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 		glLinkProgram(ID);
-		checkCompileErrors(ID, "PROGRAM");
-		// delete the shaders as they're linked into our program now and no longer necessery
-		glDeleteShader(vertex);
-		glDeleteShader(fragment);
-		if (geometryPath != nullptr)
-			glDeleteShader(geometry);
-
+		if (!async)
+			finish();
+	}
+	// true once the program is linked and checked. With KHR_parallel_shader_compile this never blocks;
+	// without it the first call simply waits for the driver
+	// ------------------------------------------------------------------------
+	bool IsReady()
+	{
+		if (ready)
+			return true;
+		if (parallelCompileSupported())
+		{
+			GLint done = GL_FALSE;
+			glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &done);
+			if (!done)
+				return false;
+		}
+		finish();
+		return true;
+	}
+	// false when compiling or linking failed; only meaningful once the program is ready
+	// ------------------------------------------------------------------------
+	bool IsLinked() const
+	{
+		return linked;
+	}
+	// blocks until the driver has linked the program
+	// ------------------------------------------------------------------------
+	void WaitUntilReady()
+	{
+		if (!ready)
+			finish();
+	}
+	// hash of the define list, independent of the order the defines were given in
+	// ------------------------------------------------------------------------
+	static unsigned long long permutationKey(const ShaderDefines &defines)
+	{
+		unsigned long long key = 0;
+		for (size_t i = 0; i < defines.size(); i++)
+			key += hashString(defines[i]);
+		return key;
+	}
+	// true when the driver advertises KHR_parallel_shader_compile (or the ARB variant)
+	// ------------------------------------------------------------------------
+	static bool parallelCompileSupported()
+	{
+		static int supported = -1;
+		if (supported < 0)
+		{
+			supported = 0;
+			GLint count = 0;
+			glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+			for (GLint i = 0; i < count; i++)
+			{
+				const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+				if (name && (std::string(name) == "GL_KHR_parallel_shader_compile" || std::string(name) == "GL_ARB_parallel_shader_compile"))
+					supported = 1;
+			}
+		}
+		return supported == 1;
 	}
 	// activate the shader
 	// ------------------------------------------------------------------------
@@ -105,64 +238,365 @@ public:
 	}
 	// utility uniform functions
 	// ------------------------------------------------------------------------
-	void setBool(const std::string &name, bool value) const
+	void setBool(UniformName name, bool value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+		glUniform1i(location(name), (int)value);
 	}
 	// ------------------------------------------------------------------------
-	void setInt(const std::string &name, int value) const
+	void setInt(UniformName name, int value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		glUniform1i(location(name), value);
 	}
 	// ------------------------------------------------------------------------
-	void setFloat(const std::string &name, float value) const
+	void setFloat(UniformName name, float value) const
 	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+		glUniform1f(location(name), value);
 	}
 	// ------------------------------------------------------------------------
-	void setVec2(const std::string &name, const glm::vec2 &value) const
+	void setVec2(UniformName name, const glm::vec2 &value) const
 	{
-		glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform2fv(location(name), 1, &value[0]);
 	}
-	void setVec2(const std::string &name, float x, float y) const
+	void setVec2(UniformName name, float x, float y) const
 	{
-		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+		glUniform2f(location(name), x, y);
 	}
 	// ------------------------------------------------------------------------
-	void setVec3(const std::string &name, const glm::vec3 &value) const
+	void setVec3(UniformName name, const glm::vec3 &value) const
 	{
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform3fv(location(name), 1, &value[0]);
 	}
-	void setVec3(const std::string &name, float x, float y, float z) const
+	void setVec3(UniformName name, float x, float y, float z) const
 	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+		glUniform3f(location(name), x, y, z);
 	}
 	// ------------------------------------------------------------------------
-	void setVec4(const std::string &name, const glm::vec4 &value) const
+	void setVec4(UniformName name, const glm::vec4 &value) const
 	{
-		glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform4fv(location(name), 1, &value[0]);
 	}
-	void setVec4(const std::string &name, float x, float y, float z, float w)
+	void setVec4(UniformName name, float x, float y, float z, float w)
 	{
-		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+		glUniform4f(location(name), x, y, z, w);
 	}
 	// ------------------------------------------------------------------------
-	void setMat2(const std::string &name, const glm::mat2 &mat) const
+	void setMat2(UniformName name, const glm::mat2 &mat) const
 	{
-		glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniformMatrix2fv(location(name), 1, GL_FALSE, &mat[0][0]);
 	}
 	// ------------------------------------------------------------------------
-	void setMat3(const std::string &name, const glm::mat3 &mat) const
+	void setMat3(UniformName name, const glm::mat3 &mat) const
+	{
+		glUniformMatrix3fv(location(name), 1, GL_FALSE, &mat[0][0]);
+	}
+	// ------------------------------------------------------------------------
+	void setMat4(UniformName name, const glm::mat4 &mat) const
+	{
+		glUniformMatrix4fv(location(name), 1, GL_FALSE, &mat[0][0]);
+	}
+	// 'count' consecutive elements of a vec4 array uniform, starting at its first element
+	void setVec4Array(UniformName name, const glm::vec4* values, int count) const
 	{
-		glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniform4fv(location(name), count, &values[0][0]);
 	}
 	// ------------------------------------------------------------------------
-	void setMat4(const std::string &name, const glm::mat4 &mat) const
+	// 'count' consecutive matrices of a mat4 array uniform, starting at its first element
+	void setMat4Array(UniformName name, const glm::mat4* mats, int count) const
 	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniformMatrix4fv(location(name), count, GL_FALSE, &mats[0][0][0]);
 	}
 
 private:
+	// stage objects live until the link has been checked
+	unsigned int vertex, fragment, geometry, tessControl, tessEvaluation;
+	bool ready;
+	bool linked;
+	std::string cacheFile;
+	// uniform name hash -> location, filled once after linking so the setters never ask the driver
+	std::unordered_map<unsigned long long, GLint> uniforms;
+
+	// ------------------------------------------------------------------------
+	GLint location(UniformName name) const
+	{
+		std::unordered_map<unsigned long long, GLint>::const_iterator it = uniforms.find(name.Hash);
+		return it == uniforms.end() ? -1 : it->second;
+	}
+	// records the location of every active uniform; arrays of basic types are also reachable without "[0]"
+	// ------------------------------------------------------------------------
+	void reflectUniforms()
+	{
+		uniforms.clear();
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+		std::vector<char> buffer(maxLength > 0 ? maxLength : 1);
+		for (GLint i = 0; i < count; i++)
+		{
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type;
+			glGetActiveUniform(ID, (GLuint)i, (GLsizei)buffer.size(), &length, &size, &type, &buffer[0]);
+			std::string name(&buffer[0], length);
+			GLint uniformLocation = glGetUniformLocation(ID, name.c_str());
+			// members of uniform blocks have no location
+			if (uniformLocation < 0)
+				continue;
+			uniforms[UniformName(name).Hash] = uniformLocation;
+			// arrays of one element report "[0]" too
+			if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+			{
+				std::string base = name.substr(0, name.size() - 3);
+				uniforms[UniformName(base).Hash] = uniformLocation;
+				for (GLint element = 1; element < size; element++)
+				{
+					std::string elementName = base + "[" + std::to_string(element) + "]";
+					uniforms[UniformName(elementName).Hash] = glGetUniformLocation(ID, elementName.c_str());
+				}
+			}
+		}
+	}
+
+	// points the shared uniform blocks the program uses at their fixed bindings; block bindings are not
+	// guaranteed to survive a program binary, so this runs after every link and load
+	// ------------------------------------------------------------------------
+	void bindUniformBlocks()
+	{
+		GLuint cameraBlock = glGetUniformBlockIndex(ID, "Camera");
+		if (cameraBlock != GL_INVALID_INDEX)
+			glUniformBlockBinding(ID, cameraBlock, CAMERA_BLOCK_BINDING);
+	}
+	// ------------------------------------------------------------------------
+	static unsigned int submitStage(GLenum type, const std::string &code)
+	{
+		const char* source = code.c_str();
+		unsigned int shader = glCreateShader(type);
+		glShaderSource(shader, 1, &source, NULL);
+		glCompileShader(shader);
+		return shader;
+	}
+	// reports compile/link errors once the driver is done, then stores the binary for the next launch
+	// ------------------------------------------------------------------------
+	void finish()
+	{
+		checkCompileErrors(vertex, "VERTEX");
+		checkCompileErrors(fragment, "FRAGMENT");
+		if (geometry != 0)
+			checkCompileErrors(geometry, "GEOMETRY");
+		if (tessControl != 0)
+			checkCompileErrors(tessControl, "TESS_CONTROL");
+		if (tessEvaluation != 0)
+			checkCompileErrors(tessEvaluation, "TESS_EVALUATION");
+		checkCompileErrors(ID, "PROGRAM");
+		GLint status = GL_FALSE;
+		glGetProgramiv(ID, GL_LINK_STATUS, &status);
+		linked = status == GL_TRUE;
+		// delete the shaders as they're linked into our program now and no longer necessery
+		glDeleteShader(vertex);
+		glDeleteShader(fragment);
+		if (geometry != 0)
+			glDeleteShader(geometry);
+		if (tessControl != 0)
+			glDeleteShader(tessControl);
+		if (tessEvaluation != 0)
+			glDeleteShader(tessEvaluation);
+		vertex = fragment = geometry = tessControl = tessEvaluation = 0;
+		reflectUniforms();
+		bindUniformBlocks();
+		saveProgramBinary(cacheFile);
+		ready = true;
+	}
+	// ------------------------------------------------------------------------
+	static std::string directoryOf(const std::string &path)
+	{
+		size_t slash = path.find_last_of("/\\");
+		return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+	}
+	// replaces every '#include "file"' line with the file's contents, resolved relative to the including file;
+	// a file that was already pulled in is skipped so shared headers need no include guards
+	// ------------------------------------------------------------------------
+	static std::string resolveIncludes(const std::string &code, const std::string &directory, std::vector<std::string> &included)
+	{
+		std::string result;
+		size_t lineStart = 0;
+		while (lineStart < code.size())
+		{
+			size_t lineEnd = code.find('\n', lineStart);
+			if (lineEnd == std::string::npos)
+				lineEnd = code.size();
+			std::string line = code.substr(lineStart, lineEnd - lineStart);
+			size_t first = line.find_first_not_of(" \t");
+			size_t open = line.find('"');
+			size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+			if (first != std::string::npos && line.compare(first, 8, "#include") == 0 && close != std::string::npos)
+			{
+				std::string includePath = directory + line.substr(open + 1, close - open - 1);
+				bool seen = false;
+				for (size_t i = 0; i < included.size(); i++)
+					if (included[i] == includePath)
+						seen = true;
+				std::string includeCode;
+				if (!seen && ShaderSources::Get(includePath, includeCode))
+				{
+					included.push_back(includePath);
+					result += resolveIncludes(includeCode, directoryOf(includePath), included);
+					result += '\n';
+				}
+				else if (!seen)
+					std::cout << "ERROR::SHADER::INCLUDE_NOT_FOUND: " << includePath << std::endl;
+			}
+			else
+			{
+				result += line;
+				result += '\n';
+			}
+			lineStart = lineEnd + 1;
+		}
+		return result;
+	}
+	// ------------------------------------------------------------------------
+	std::string loadSource(const char* path, const ShaderDefines &defines)
+	{
+		SourceFiles.push_back(path);
+		std::string code;
+		if (!ShaderSources::Get(path, code))
+		{
+			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << path << std::endl;
+			return std::string();
+		}
+		// includes are expanded once per stage, but every file is listed once per program
+		std::vector<std::string> included;
+		std::string result = preprocess(code, path, defines, included);
+		for (size_t i = 0; i < included.size(); i++)
+			if (std::find(SourceFiles.begin(), SourceFiles.end(), included[i]) == SourceFiles.end())
+				SourceFiles.push_back(included[i]);
+		return result;
+	}
+	// ------------------------------------------------------------------------
+	static std::string preprocess(const std::string &code, const std::string &path, const ShaderDefines &defines, std::vector<std::string> &included)
+	{
+		std::string result = resolveIncludes(code, directoryOf(path), included);
+		// the defines have to follow #version, which must stay the first statement
+		size_t insertAt = 0;
+		size_t version = result.find("#version");
+		if (version != std::string::npos)
+		{
+			insertAt = result.find('\n', version);
+			insertAt = insertAt == std::string::npos ? result.size() : insertAt + 1;
+		}
+		std::string header;
+		for (size_t i = 0; i < defines.size(); i++)
+			header += "#define " + defines[i] + "\n";
+		result.insert(insertAt, header);
+		return result;
+	}
+	// program binaries need GL 4.1 (or ARB_get_program_binary) and at least one binary format from the driver
+	// ------------------------------------------------------------------------
+	static bool programBinarySupported()
+	{
+		static int supported = -1;
+		if (supported < 0)
+		{
+			GLint formats = 0;
+			if (GLAD_GL_VERSION_4_1)
+				glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+			supported = formats > 0 ? 1 : 0;
+		}
+		return supported == 1;
+	}
+	// 64 bit FNV-1a, good enough to tell shader sources and driver builds apart
+	// ------------------------------------------------------------------------
+	static unsigned long long hashString(const std::string &text, unsigned long long hash = 14695981039346656037ULL)
+	{
+		for (size_t i = 0; i < text.size(); i++)
+		{
+			hash ^= (unsigned char)text[i];
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+	// ------------------------------------------------------------------------
+	static std::string glString(GLenum name)
+	{
+		const GLubyte* value = glGetString(name);
+		return value ? std::string((const char*)value) : std::string();
+	}
+	// cache file name for a program; a new driver or any edit to the sources gives a new key
+	// ------------------------------------------------------------------------
+	static std::string binaryCachePath(const std::string &vertexCode, const std::string &fragmentCode, const std::string &geometryCode,
+		const std::string &tessellationCode)
+	{
+		unsigned long long key = hashString(vertexCode);
+		key = hashString(fragmentCode, key);
+		key = hashString(geometryCode, key);
+		key = hashString(tessellationCode, key);
+		key = hashString(glString(GL_VENDOR), key);
+		key = hashString(glString(GL_RENDERER), key);
+		key = hashString(glString(GL_VERSION), key);
+		char name[64];
+		snprintf(name, sizeof(name), "shadercache/%016llx.bin", key);
+		return name;
+	}
+	// loads a cached binary into a fresh program, returns false (and leaves no program behind) when there is
+	// no usable binary so the caller falls back to compiling
+	// ------------------------------------------------------------------------
+	bool loadProgramBinary(const std::string &path)
+	{
+		if (!programBinarySupported())
+			return false;
+		std::ifstream file(path.c_str(), std::ios::binary | std::ios::ate);
+		if (!file.is_open())
+			return false;
+		std::streamoff size = file.tellg();
+		if (size <= (std::streamoff)sizeof(GLenum))
+			return false;
+		GLenum format;
+		std::vector<char> binary((size_t)size - sizeof(GLenum));
+		file.seekg(0);
+		file.read((char*)&format, sizeof(GLenum));
+		file.read(&binary[0], binary.size());
+		if (!file)
+			return false;
+
+		ID = glCreateProgram();
+		glProgramBinary(ID, format, &binary[0], (GLsizei)binary.size());
+		GLint success = GL_FALSE;
+		glGetProgramiv(ID, GL_LINK_STATUS, &success);
+		if (success)
+		{
+			reflectUniforms();
+			bindUniformBlocks();
+			return true;
+		}
+		// the driver rejected the binary (usually after an update), drop it and compile from source
+		glDeleteProgram(ID);
+		ID = 0;
+		remove(path.c_str());
+		return false;
+	}
+	// ------------------------------------------------------------------------
+	void saveProgramBinary(const std::string &path)
+	{
+		GLint linked = GL_FALSE, length = 0;
+		glGetProgramiv(ID, GL_LINK_STATUS, &linked);
+		if (!linked || !programBinarySupported())
+			return;
+		glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+			return;
+		std::vector<char> binary(length);
+		GLenum format;
+		glGetProgramBinary(ID, length, NULL, &format, &binary[0]);
+#ifdef _WIN32
+		_mkdir("shadercache");
+#else
+		mkdir("shadercache", 0755);
+#endif
+		std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+			return;
+		file.write((const char*)&format, sizeof(GLenum));
+		file.write(&binary[0], binary.size());
+	}
 	// utility function for checking shader compilation/linking errors.
 	// ------------------------------------------------------------------------
 	void checkCompileErrors(GLuint shader, std::string type)
@@ -190,124 +624,3 @@ private:
 	}
 };
 #endif
-//#ifndef SHADER_H
-//#define SHADER_H
-//
-//#include <glad/glad.h>
-//
-//#include <string>
-//#include <fstream>
-//#include <sstream>
-//#include <iostream>
-//
-//class Shader
-//{
-//public:
-//	unsigned int ID;
-//	// constructor generates the shader on the fly
-//	// ------------------------------------------------------------------------
-//	Shader(const char* vertexPath, const char* fragmentPath)
-//	{
-//		// 1. retrieve the vertex/fragment source code from filePath
-//		std::string vertexCode;
-//		std::string fragmentCode;
-//		std::ifstream vShaderFile;
-//		std::ifstream fShaderFile;
-//		// ensure ifstream objects can throw exceptions:
-//		vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-//		fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-//		try
-//		{
-//			// open files
-//			vShaderFile.open(vertexPath);
-//			fShaderFile.open(fragmentPath);
-//			std::stringstream vShaderStream, fShaderStream;
-//			// read file's buffer contents into streams
-//			vShaderStream << vShaderFile.rdbuf();
-//			fShaderStream << fShaderFile.rdbuf();
-//			// close file handlers
-//			vShaderFile.close();
-//			fShaderFile.close();
-//			// convert stream into string
-//			vertexCode = vShaderStream.str();
-//			fragmentCode = fShaderStream.str();
-//		}
-//		catch (std::ifstream::failure& e)
-//		{
-//			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
-//		}
-//		const char* vShaderCode = vertexCode.c_str();
-//		const char * fShaderCode = fragmentCode.c_str();
-//		// 2. compile shaders
-//		unsigned int vertex, fragment;
-//		// vertex shader
-//		vertex = glCreateShader(GL_VERTEX_SHADER);
-//		glShaderSource(vertex, 1, &vShaderCode, NULL);
-//		glCompileShader(vertex);
-//		checkCompileErrors(vertex, "VERTEX");
-//		// fragment Shader
-//		fragment = glCreateShader(GL_FRAGMENT_SHADER);
-//		glShaderSource(fragment, 1, &fShaderCode, NULL);
-//		glCompileShader(fragment);
-//		checkCompileErrors(fragment, "FRAGMENT");
-//		// shader Program
-//		ID = glCreateProgram();
-//		glAttachShader(ID, vertex);
-//		glAttachShader(ID, fragment);
-//		glLinkProgram(ID);
-//		checkCompileErrors(ID, "PROGRAM");
-//		// delete the shaders as they're linked into our program now and no longer necessary
-//		glDeleteShader(vertex);
-//		glDeleteShader(fragment);
-//	}
-//	// activate the shader
-//	// ------------------------------------------------------------------------
-//	void use()
-//	{
-//		glUseProgram(ID);
-//	}
-//	// utility uniform functions
-//	// ------------------------------------------------------------------------
-//	void setBool(const std::string &name, bool value) const
-//	{
-//		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
-//	}
-//	// ------------------------------------------------------------------------
-//	void setInt(const std::string &name, int value) const
-//	{
-//		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
-//	}
-//	// ------------------------------------------------------------------------
-//	void setFloat(const std::string &name, float value) const
-//	{
-//		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
-//	}
-//
-//private:
-//	// utility function for checking shader compilation/linking errors.
-//	// ------------------------------------------------------------------------
-//	void checkCompileErrors(unsigned int shader, std::string type)
-//	{
-//		int success;
-//		char infoLog[1024];
-//		if (type != "PROGRAM")
-//		{
-//			glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-//			if (!success)
-//			{
-//				glGetShaderInfoLog(shader, 1024, NULL, infoLog);
-//				std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
-//			}
-//		}
-//		else
-//		{
-//			glGetProgramiv(shader, GL_LINK_STATUS, &success);
-//			if (!success)
-//			{
-//				glGetProgramInfoLog(shader, 1024, NULL, infoLog);
-//				std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
-//			}
-//		}
-//	}
-//};
-//#endif
\ No newline at end of file
@@ -0,0 +1,322 @@
+#ifndef SHADER_MANAGER_H
+#define SHADER_MANAGER_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include "shader.h"
+#include "file_watcher.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef unsigned int ShaderHandle;
+
+// The shader library: owns every program the renderer uses. Sources come from the shared ShaderSources cache,
+// programs are hashed into the binary cache and their uniforms reflected by Shader. All programs are submitted
+// up front so the driver can compile them in parallel (KHR_parallel_shader_compile); until a program is ready,
+// Get() hands out a small fallback program that is compiled synchronously, so the first frames never wait on
+// the compiler. The fallback has to read the vertices the way the program would, so it is built once per
+// vertex layout: as the permutation of the fallback sources with those of the program's defines that are
+// layout defines.
+//
+// With hot reload enabled, a thread with its own (shared) GL context watches the shader directory, rebuilds
+// every program that uses an edited file and hands finished programs over through Poll(), which swaps them
+// in between frames. A program that fails to build is reported and the old one stays in use.
+class ShaderManager
+{
+public:
+	// 'fallbackLayouts' are the defines that change the vertex layout, e.g. "INSTANCED"; the fallback sources
+	// have to understand every one of them
+	ShaderManager(GLADloadproc loader, const char* fallbackVertexPath, const char* fallbackFragmentPath, const ShaderDefines &fallbackLayouts = ShaderDefines())
+		: fallbackVertexPath(fallbackVertexPath), fallbackFragmentPath(fallbackFragmentPath), fallbackLayouts(fallbackLayouts),
+		reloadContext(NULL), reloadRunning(false), reloadsQueued(false), waitedForAll(false)
+	{
+		// let the driver use as many compiler threads as it likes
+		if (Shader::parallelCompileSupported())
+		{
+			typedef void (APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+			MaxShaderCompilerThreadsProc maxShaderCompilerThreads = (MaxShaderCompilerThreadsProc)loader("glMaxShaderCompilerThreadsKHR");
+			if (maxShaderCompilerThreads == NULL)
+				maxShaderCompilerThreads = (MaxShaderCompilerThreadsProc)loader("glMaxShaderCompilerThreadsARB");
+			if (maxShaderCompilerThreads != NULL)
+				maxShaderCompilerThreads(0xFFFFFFFFu);
+		}
+		fallbackFor(ShaderDefines());
+	}
+
+	// queues a program (permutation) for compilation and returns immediately; asking for a permutation that
+	// was already submitted returns the existing handle. Programs with tessellation stages need GL 4.0
+	ShaderHandle Submit(const char* vertexPath, const char* fragmentPath, const ShaderDefines &defines = ShaderDefines(), const char* geometryPath = nullptr,
+		const char* tessControlPath = nullptr, const char* tessEvaluationPath = nullptr)
+	{
+		std::string name = std::string(vertexPath) + "|" + fragmentPath + "|" + (geometryPath ? geometryPath : "")
+			+ "|" + (tessControlPath ? tessControlPath : "") + "|" + (tessEvaluationPath ? tessEvaluationPath : "");
+		unsigned long long key = Shader::permutationKey(defines);
+		for (size_t i = 0; i < programs.size(); i++)
+			if (names[i] == name && programs[i]->PermutationKey == key)
+				return (ShaderHandle)i;
+		programs.push_back(std::unique_ptr<Shader>(new Shader(vertexPath, fragmentPath, geometryPath, defines, true, tessControlPath, tessEvaluationPath)));
+		names.push_back(name);
+		pending.push_back(true);
+		ShaderDefines layout;
+		for (size_t i = 0; i < defines.size(); i++)
+			if (std::find(fallbackLayouts.begin(), fallbackLayouts.end(), defines[i]) != fallbackLayouts.end())
+				layout.push_back(defines[i]);
+		fallbackOf.push_back(fallbackFor(layout));
+		ProgramSource source;
+		source.vertexPath = vertexPath;
+		source.fragmentPath = fragmentPath;
+		source.geometryPath = geometryPath ? geometryPath : "";
+		source.tessControlPath = tessControlPath ? tessControlPath : "";
+		source.tessEvaluationPath = tessEvaluationPath ? tessEvaluationPath : "";
+		source.defines = defines;
+		sources.push_back(source);
+		return (ShaderHandle)(programs.size() - 1);
+	}
+
+	~ShaderManager()
+	{
+		StopHotReload();
+	}
+
+	// call once per frame; returns true when at least one program became ready or was reloaded, so
+	// per-program setup (sampler units and the like) can be applied to it
+	bool Poll()
+	{
+		bool changed = waitedForAll;
+		waitedForAll = false;
+		if (reloadsQueued.load(std::memory_order_acquire))
+			changed |= applyReloads();
+		for (size_t i = 0; i < programs.size(); i++)
+		{
+			if (pending[i] && programs[i]->IsReady())
+			{
+				pending[i] = false;
+				changed = true;
+			}
+		}
+		return changed;
+	}
+
+	bool IsReady(ShaderHandle handle) const
+	{
+		return !pending[handle];
+	}
+
+	bool AllReady() const
+	{
+		for (size_t i = 0; i < pending.size(); i++)
+			if (pending[i])
+				return false;
+		return true;
+	}
+
+	// true while a program is still compiling or a reloaded one waits to be swapped in; Poll() has work to do
+	bool Busy() const
+	{
+		return !AllReady() || reloadsQueued.load(std::memory_order_acquire);
+	}
+
+	// the requested program when it is ready, the fallback program for its vertex layout otherwise
+	Shader& Get(ShaderHandle handle)
+	{
+		return pending[handle] ? *fallbacks[fallbackOf[handle]] : *programs[handle];
+	}
+
+	// blocks until every submitted program is linked; the next Poll() still reports them, so their setup runs
+	void WaitAll()
+	{
+		for (size_t i = 0; i < programs.size(); i++)
+		{
+			programs[i]->WaitUntilReady();
+			pending[i] = false;
+		}
+		waitedForAll = true;
+	}
+
+	// starts watching 'directory'; call on the main thread after every program has been submitted
+	void EnableHotReload(GLFWwindow* window, const char* directory)
+	{
+		if (reloadContext != NULL)
+			return;
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		reloadContext = glfwCreateWindow(1, 1, "shader reload", NULL, window);
+		glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+		if (reloadContext == NULL)
+		{
+			std::cout << "Shader hot reload disabled: could not create a shared context" << std::endl;
+			return;
+		}
+		// the reload thread keeps its own copy of the file lists, it never touches the live programs
+		watchedFiles.clear();
+		for (size_t i = 0; i < programs.size(); i++)
+			watchedFiles.push_back(programs[i]->SourceFiles);
+		watchDirectory = directory;
+		reloadRunning = true;
+		reloadThread = std::thread(&ShaderManager::hotReloadLoop, this);
+	}
+
+	// stops the reload thread; must run before glfwTerminate
+	void StopHotReload()
+	{
+		if (reloadContext == NULL)
+			return;
+		reloadRunning = false;
+		reloadThread.join();
+		glfwDestroyWindow(reloadContext);
+		reloadContext = NULL;
+		for (size_t i = 0; i < reloads.size(); i++)
+		{
+			glDeleteSync(reloads[i].fence);
+			delete reloads[i].program;
+		}
+		reloads.clear();
+	}
+
+private:
+	// everything needed to build a program again
+	struct ProgramSource
+	{
+		std::string vertexPath;
+		std::string fragmentPath;
+		std::string geometryPath;
+		std::string tessControlPath;
+		std::string tessEvaluationPath;
+		ShaderDefines defines;
+	};
+
+	// a rebuilt program waiting for its fence before it replaces the live one
+	struct Reload
+	{
+		ShaderHandle handle;
+		Shader* program;
+		GLsync fence;
+	};
+
+	// index of the fallback program for a vertex layout, built on first use; there are only a few layouts
+	size_t fallbackFor(const ShaderDefines &layout)
+	{
+		unsigned long long key = Shader::permutationKey(layout);
+		for (size_t i = 0; i < fallbacks.size(); i++)
+			if (fallbacks[i]->PermutationKey == key)
+				return i;
+		fallbacks.push_back(std::unique_ptr<Shader>(new Shader(fallbackVertexPath.c_str(), fallbackFragmentPath.c_str(), nullptr, layout)));
+		return fallbacks.size() - 1;
+	}
+
+	// hot reload thread: wait for edits, rebuild affected programs on the reload context, queue them
+	void hotReloadLoop()
+	{
+		glfwMakeContextCurrent(reloadContext);
+		FileWatcher watcher(watchDirectory);
+		for (size_t i = 0; i < watchedFiles.size(); i++)
+			for (size_t j = 0; j < watchedFiles[i].size(); j++)
+				watcher.AddFile(watchedFiles[i][j]);
+
+		while (reloadRunning)
+		{
+			std::vector<std::string> changed;
+			watcher.Wait(250, changed);
+			if (changed.empty())
+				continue;
+			for (size_t i = 0; i < changed.size(); i++)
+				ShaderSources::Invalidate(changed[i]);
+
+			for (size_t i = 0; i < watchedFiles.size(); i++)
+			{
+				bool affected = false;
+				for (size_t j = 0; j < changed.size(); j++)
+					if (std::find(watchedFiles[i].begin(), watchedFiles[i].end(), changed[j]) != watchedFiles[i].end())
+						affected = true;
+				if (!affected)
+					continue;
+
+				const ProgramSource &source = sources[i];
+				Shader* program = new Shader(source.vertexPath.c_str(), source.fragmentPath.c_str(),
+					source.geometryPath.empty() ? nullptr : source.geometryPath.c_str(), source.defines, false,
+					source.tessControlPath.empty() ? nullptr : source.tessControlPath.c_str(),
+					source.tessEvaluationPath.empty() ? nullptr : source.tessEvaluationPath.c_str());
+				if (!program->IsLinked())
+				{
+					std::cout << "Shader hot reload failed, keeping the previous program: " << source.fragmentPath << std::endl;
+					glDeleteProgram(program->ID);
+					delete program;
+					continue;
+				}
+				// an edit may have added an #include
+				watchedFiles[i] = program->SourceFiles;
+				for (size_t j = 0; j < watchedFiles[i].size(); j++)
+					watcher.AddFile(watchedFiles[i][j]);
+
+				Reload reload;
+				reload.handle = (ShaderHandle)i;
+				reload.program = program;
+				reload.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+				glFlush();
+				std::lock_guard<std::mutex> lock(reloadMutex);
+				reloads.push_back(reload);
+				reloadsQueued.store(true, std::memory_order_release);
+				// wake a render loop that sleeps in glfwWaitEvents*
+				glfwPostEmptyEvent();
+			}
+		}
+		glfwMakeContextCurrent(NULL);
+	}
+
+	// swaps in every reloaded program whose commands have completed; never blocks the render thread
+	bool applyReloads()
+	{
+		std::unique_lock<std::mutex> lock(reloadMutex, std::try_to_lock);
+		if (!lock.owns_lock())
+			return false;
+		bool changed = false;
+		for (size_t i = 0; i < reloads.size();)
+		{
+			Reload &reload = reloads[i];
+			if (pending[reload.handle] || glClientWaitSync(reload.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+			{
+				i++;
+				continue;
+			}
+			glDeleteSync(reload.fence);
+			glDeleteProgram(programs[reload.handle]->ID);
+			programs[reload.handle].reset(reload.program);
+			std::cout << "Shader reloaded: " << sources[reload.handle].fragmentPath << std::endl;
+			reloads.erase(reloads.begin() + i);
+			changed = true;
+		}
+		reloadsQueued.store(!reloads.empty(), std::memory_order_release);
+		return changed;
+	}
+
+	std::string fallbackVertexPath;
+	std::string fallbackFragmentPath;
+	ShaderDefines fallbackLayouts;
+	std::vector<std::unique_ptr<Shader> > fallbacks;
+	std::vector<std::unique_ptr<Shader> > programs;
+	// index into 'fallbacks' per program
+	std::vector<size_t> fallbackOf;
+	std::vector<std::string> names;
+	std::vector<bool> pending;
+	std::vector<ProgramSource> sources;
+
+	// hot reload state
+	GLFWwindow* reloadContext;
+	std::thread reloadThread;
+	std::atomic<bool> reloadRunning;
+	std::atomic<bool> reloadsQueued;
+	std::mutex reloadMutex;
+	std::vector<Reload> reloads;
+	std::vector<std::vector<std::string> > watchedFiles;
+	std::string watchDirectory;
+	// WaitAll() made programs ready that Poll() has not reported yet
+	bool waitedForAll;
+};
+#endif
@@ -1,11 +1,29 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
+#ifdef PACKED_VERTICES
+// as in 6.multiple_lights.vs: normalized within the mesh bounds. The program also stands in for the lit ones
+// until they are built, so it reads their vertex layouts
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+#endif
 
+#ifdef INSTANCED
+layout (location = 3) in mat4 aModel;
+#else
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#endif
+
+#include "camera.glsl"
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+#ifdef PACKED_VERTICES
+    vec3 position = aPos * positionScale + positionOffset;
+#else
+    vec3 position = aPos;
+#endif
+#ifdef INSTANCED
+    mat4 model = aModel;
+#endif
+    gl_Position = viewProjection * model * vec4(position, 1.0);
 }
\ No newline at end of file
@@ -1,21 +1,96 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
+#ifdef PACKED_VERTICES
+// PackedVertex (mesh.h): aPos is normalized within the mesh bounds, the normal is octahedral in xy with half
+// its length in z
+layout (location = 1) in vec4 aPackedNormal;
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+#else
 layout (location = 1) in vec3 aNormal;
+#endif
 layout (location = 2) in vec2 aTexCoords;
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
+// the depth pre-pass and the lit pass are separate programs; both have to land on the same depth
+invariant gl_Position;
 
+#ifdef INSTANCED
+// per instance model matrix, one column per location
+layout (location = 3) in mat4 aModel;
+#else
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#endif
+#include "camera.glsl"
+
+#ifdef GPU_LATHE
+// --gpu-lathe: lathed pieces have no vertex data. Their half outline is a buffer texture of (x, y, normal y, v)
+// per point, and each vertex is derived from gl_VertexID: six per outline segment and slice, two triangles
+// laid out as OutlineModel's
+uniform samplerBuffer latheOutline;
+uniform int latheSlices; // 0 for meshes with vertex data
+
+void latheVertex(out vec3 position, out vec3 normal, out vec2 texCoords)
+{
+    int segments = textureSize(latheOutline) - 1;
+    int quad = gl_VertexID / 6;
+    int corner = gl_VertexID - quad * 6;
+    // corners: (i, j) (i + 1, j) (i, j + 1) (i + 1, j) (i, j + 1) (i + 1, j + 1)
+    int point = quad % segments + ((corner == 1 || corner == 3 || corner == 5) ? 1 : 0);
+    int slice = quad / segments + ((corner == 2 || corner >= 4) ? 1 : 0);
+    vec4 outline = texelFetch(latheOutline, point);
+    float angle = 6.28318531 * float(slice) / float(latheSlices);
+    position = vec3(outline.x * cos(angle), outline.y, outline.x * sin(angle));
+    // the same per quadrant signs OutlineModel writes; the first slice is the outline itself
+    if (slice == 0)
+        normal = vec3(1.0, outline.z, 0.0);
+    else
+        normal = vec3((slice * 4 > latheSlices && slice * 4 < latheSlices * 3) ? -1.0 : 1.0, outline.z, slice * 2 <= latheSlices ? 1.0 : -1.0);
+    texCoords = vec2(float(slice) / float(latheSlices), outline.w);
+}
+#endif
+
+#ifdef PACKED_VERTICES
+vec3 decodeNormal(vec4 encoded)
+{
+    vec3 n = vec3(encoded.xy, 1.0 - abs(encoded.x) - abs(encoded.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n) * encoded.z * 2.0;
+}
+#endif
 
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;  
-    TexCoords = aTexCoords;
+    vec3 position;
+    vec3 normal;
+    vec2 texCoords = aTexCoords;
+#ifdef GPU_LATHE
+    if (latheSlices > 0)
+        latheVertex(position, normal, texCoords);
+    else
+#endif
+    {
+#ifdef PACKED_VERTICES
+        position = aPos * positionScale + positionOffset;
+        normal = decodeNormal(aPackedNormal);
+#else
+        position = aPos;
+        normal = aNormal;
+#endif
+    }
+#ifdef INSTANCED
+    // instance transforms are rigid (translation and rotation), so the model matrix is its own normal matrix
+    mat4 model = aModel;
+    FragPos = vec3(model * vec4(position, 1.0));
+    Normal = mat3(model) * normal;
+#else
+    FragPos = vec3(model * vec4(position, 1.0));
+    Normal = mat3(transpose(inverse(model))) * normal;  
+#endif
+    TexCoords = texCoords;
     
-    gl_Position = projection * view * vec4(FragPos, 1.0);
+    gl_Position = worldToClip(FragPos);
 }
\ No newline at end of file
@@ -0,0 +1,23 @@
+// camera uniform block, written once per frame by CameraBuffer (camera.h); std140 so the C++ side can mirror it
+layout (std140) uniform Camera
+{
+    mat4 projection;
+    mat4 view;
+    mat4 viewProjection;
+    vec4 viewPosition;
+};
+
+#ifdef SHADOW_CASTER
+// shadow map pass (ShadowMaps, shadow_maps.h): everything is projected with the light's matrix instead
+uniform mat4 lightViewProjection;
+
+vec4 worldToClip(vec3 position)
+{
+    return lightViewProjection * vec4(position, 1.0);
+}
+#else
+vec4 worldToClip(vec3 position)
+{
+    return viewProjection * vec4(position, 1.0);
+}
+#endif
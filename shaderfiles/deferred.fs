@@ -0,0 +1,62 @@
+#version 330 core
+out vec4 FragColor;
+
+// lighting of the deferred renderer, the same light model as 6.multiple_lights.fs applied to the G-buffer.
+// Permutation switches, injected by the Shader class:
+//   LIGHT_VOLUME        one point light per instance, added onto the full screen pass; without it the
+//                       directional light and the flashlight, which also copy the G-buffer depth
+//   PRESENT             copies the summed light and the depth to the framebuffer, no lighting
+//   NR_POINT_LIGHTS n   size of pointLights (LIGHT_VOLUME only)
+//   SPOT_LIGHT          camera flashlight on
+//   SHADOWS ...         shadow maps, see shadows.glsl
+#ifndef NR_POINT_LIGHTS
+#define NR_POINT_LIGHTS 0
+#endif
+
+#include "camera.glsl"
+#include "lighting.glsl"
+#include "shadows.glsl"
+#include "gbuffer.glsl"
+
+#if defined(PRESENT)
+uniform sampler2D lightBuffer;
+#elif defined(LIGHT_VOLUME)
+flat in int lightIndex;
+uniform PointLight pointLights[NR_POINT_LIGHTS];
+#else
+uniform DirLight dirLight;
+#ifdef SPOT_LIGHT
+uniform SpotLight spotLight;
+#endif
+#endif
+
+void main()
+{
+#ifdef PRESENT
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    FragColor = vec4(texelFetch(lightBuffer, texel, 0).rgb, 1.0);
+    gl_FragDepth = texelFetch(gbufferDepth, texel, 0).r;
+#else
+    Surface surface;
+    vec3 position;
+    vec3 norm;
+    float depth;
+    // the background keeps the clear color; the shadow maps have no mipmaps, so their lookups don't mind
+    // the divergence
+    if (!ReadGBuffer(surface, position, norm, depth))
+        discard;
+    vec3 viewDir = normalize(viewPosition.xyz - position);
+#ifdef LIGHT_VOLUME
+    PointLight light = pointLights[lightIndex];
+    FragColor = vec4(CalcPointLight(light, surface, norm, position, viewDir, PointShadow(lightIndex, light.position, position, norm)), 1.0);
+#else
+    vec3 result = CalcDirLight(dirLight, surface, norm, viewDir, DirectionalShadow(position, norm));
+#ifdef SPOT_LIGHT
+    result += CalcSpotLight(spotLight, surface, norm, position, viewDir);
+#endif
+    FragColor = vec4(result, 1.0);
+    // the point light volumes are tested against it
+    gl_FragDepth = depth;
+#endif
+#endif
+}
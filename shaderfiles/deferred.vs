@@ -0,0 +1,23 @@
+#version 330 core
+// lighting passes of the deferred renderer (GBuffer, gbuffer.h). Without LIGHT_VOLUME one triangle covers the
+// screen, its corners made from gl_VertexID; with it each instance is the volume of one point light, the unit
+// cube scaled around the light to the distance it reaches
+#include "camera.glsl"
+
+#ifdef LIGHT_VOLUME
+layout (location = 0) in vec3 aPos;
+// center and reach of every point light
+uniform vec4 lightVolumes[NR_POINT_LIGHTS];
+flat out int lightIndex;
+#endif
+
+void main()
+{
+#ifdef LIGHT_VOLUME
+    vec4 volume = lightVolumes[gl_InstanceID];
+    lightIndex = gl_InstanceID;
+    gl_Position = worldToClip(volume.xyz + aPos * volume.w);
+#else
+    gl_Position = vec4(float((gl_VertexID & 1) * 4 - 1), float((gl_VertexID & 2) * 2 - 1), 0.0, 1.0);
+#endif
+}
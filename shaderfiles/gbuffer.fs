@@ -0,0 +1,27 @@
+#version 330 core
+// G-buffer pass of the deferred renderer: the surface 6.multiple_lights.fs would light, stored for deferred.fs
+layout (location = 0) out vec4 outAlbedo;
+layout (location = 1) out vec4 outSpecular;
+layout (location = 2) out vec2 outNormal;
+
+#include "lighting.glsl"
+#include "gbuffer.glsl"
+
+struct Material {
+    sampler2D diffuse;
+    sampler2D specular;
+    float shininess;
+};
+
+in vec3 FragPos;
+in vec3 Normal;
+in vec2 TexCoords;
+
+uniform Material material;
+
+void main()
+{
+    outAlbedo = vec4(texture(material.diffuse, TexCoords).rgb, 1.0);
+    outSpecular = vec4(texture(material.specular, TexCoords).rgb, material.shininess / GBUFFER_SHININESS_SCALE);
+    outNormal = EncodeNormal(normalize(Normal));
+}
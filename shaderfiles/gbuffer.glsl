@@ -0,0 +1,45 @@
+// G-buffer of the deferred renderer (GBuffer, gbuffer.h): written by gbuffer.fs, read back by deferred.fs.
+// What is stored is lighting.glsl's Surface plus the normal, so both renderers light the same values
+
+uniform sampler2D gbufferAlbedo;
+uniform sampler2D gbufferSpecular;
+uniform sampler2D gbufferNormal;
+uniform sampler2D gbufferDepth;
+// window coordinates back to world space
+uniform mat4 inverseViewProjection;
+
+// shininess is stored in 8 bit steps, so whole exponents up to 255 come back exactly
+const float GBUFFER_SHININESS_SCALE = 255.0;
+
+// octahedral, mapped to [0, 1] for the unsigned normal target
+vec2 EncodeNormal(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 encoded = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return encoded * 0.5 + 0.5;
+}
+
+vec3 DecodeNormal(vec2 encoded)
+{
+    encoded = encoded * 2.0 - 1.0;
+    vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
+// the surface under the fragment; false where nothing was drawn
+bool ReadGBuffer(out Surface surface, out vec3 position, out vec3 normal, out float depth)
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    depth = texelFetch(gbufferDepth, texel, 0).r;
+    vec4 specular = texelFetch(gbufferSpecular, texel, 0);
+    surface.diffuse = texelFetch(gbufferAlbedo, texel, 0).rgb;
+    surface.specular = specular.rgb;
+    surface.shininess = specular.a * GBUFFER_SHININESS_SCALE;
+    normal = DecodeNormal(texelFetch(gbufferNormal, texel, 0).xy);
+    vec2 window = gl_FragCoord.xy / vec2(textureSize(gbufferDepth, 0));
+    vec4 world = inverseViewProjection * vec4(vec3(window, depth) * 2.0 - 1.0, 1.0);
+    position = world.xyz / world.w;
+    return depth < 1.0;
+}
@@ -0,0 +1,34 @@
+#version 400 core
+// --tessellate: a lathed piece is a coarse lathe drawn as patches of four control points, one patch per
+// outline segment and slice. Like --gpu-lathe there is no vertex data; the half outline is a buffer texture
+// of (x, y, normal y, v) per point and each control point comes from gl_VertexID
+uniform samplerBuffer latheOutline;
+
+#ifdef INSTANCED
+// per instance model matrix, one column per location
+layout (location = 3) in mat4 aModel;
+#else
+uniform mat4 model;
+#endif
+
+out ControlPoint
+{
+    vec4 outline;
+    float slice;
+    mat4 model;
+} controlPoint;
+
+void main()
+{
+    int segments = textureSize(latheOutline) - 1;
+    int quad = gl_VertexID / 4;
+    int corner = gl_VertexID - quad * 4;
+    // corners: (i, j) (i, j + 1) (i + 1, j) (i + 1, j + 1), outline point i and slice j
+    controlPoint.outline = texelFetch(latheOutline, quad % segments + corner / 2);
+    controlPoint.slice = float(quad / segments + corner % 2);
+#ifdef INSTANCED
+    controlPoint.model = aModel;
+#else
+    controlPoint.model = model;
+#endif
+}
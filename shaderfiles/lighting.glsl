@@ -0,0 +1,102 @@
+// shared light model for every lit program; included after the #version line and the permutation defines
+
+struct DirLight {
+    vec3 direction;
+	
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct PointLight {
+    vec3 position;
+    
+    float constant;
+    float linear;
+    float quadratic;
+	
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct SpotLight {
+    vec3 position;
+    vec3 direction;
+    float cutOff;
+    float outerCutOff;
+  
+    float constant;
+    float linear;
+    float quadratic;
+  
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;       
+};
+
+// material values for one fragment, sampled once and shared by every light
+struct Surface {
+    vec3 diffuse;
+    vec3 specular;
+    float shininess;
+};
+
+// calculates the color when using a directional light; 'shadow' is the lit fraction (1 unshadowed), it
+// leaves the ambient term alone
+vec3 CalcDirLight(DirLight light, Surface surface, vec3 normal, vec3 viewDir, float shadow)
+{
+    vec3 lightDir = normalize(-light.direction);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    // specular shading
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), surface.shininess);
+    // combine results
+    vec3 ambient = light.ambient * surface.diffuse;
+    vec3 diffuse = light.diffuse * diff * surface.diffuse;
+    vec3 specular = light.specular * spec * surface.specular;
+    return (ambient + (diffuse + specular) * shadow);
+}
+
+// calculates the color when using a point light; 'shadow' as for the directional light
+vec3 CalcPointLight(PointLight light, Surface surface, vec3 normal, vec3 fragPos, vec3 viewDir, float shadow)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    // specular shading
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), surface.shininess);
+    // attenuation
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));    
+    // combine results
+    vec3 ambient = light.ambient * surface.diffuse;
+    vec3 diffuse = light.diffuse * diff * surface.diffuse;
+    vec3 specular = light.specular * spec * surface.specular;
+    return (ambient + (diffuse + specular) * shadow) * attenuation;
+}
+
+// calculates the color when using a spot light.
+vec3 CalcSpotLight(SpotLight light, Surface surface, vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    // specular shading
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), surface.shininess);
+    // attenuation
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));    
+    // spotlight intensity
+    float theta = dot(lightDir, normalize(-light.direction)); 
+    float epsilon = light.cutOff - light.outerCutOff;
+    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+    // combine results
+    vec3 ambient = light.ambient * surface.diffuse;
+    vec3 diffuse = light.diffuse * diff * surface.diffuse;
+    vec3 specular = light.specular * spec * surface.specular;
+    return (ambient + diffuse + specular) * attenuation * intensity;
+}
@@ -0,0 +1,95 @@
+// shadow lookups of the lit programs; included after lighting.glsl. The maps are ShadowMaps (shadow_maps.h),
+// layers of two depth array textures compared in hardware. Permutation switches:
+//   SHADOWS              shadows at all; without it every light is unshadowed
+//   SHADOW_CASCADES n    directional light cascades, from the finest box to the coarsest
+//   SHADOW_PCF_TAPS n    1: one bilinear comparison (2x2 PCF), 4: four of them half a texel apart (3x3 tent)
+//   SHADOW_POINT_LIGHTS n  the first n point lights have maps (default all of them), the others are unshadowed
+#ifdef SHADOWS
+#ifndef SHADOW_PCF_TAPS
+#define SHADOW_PCF_TAPS 4
+#endif
+#ifndef SHADOW_POINT_LIGHTS
+#define SHADOW_POINT_LIGHTS NR_POINT_LIGHTS
+#endif
+
+// the receiver is moved along its normal before the lookup, which keeps curved surfaces free of acne
+const float SHADOW_NORMAL_OFFSET = 0.02;
+
+uniform sampler2DArrayShadow cascadeShadowMap;
+uniform mat4 cascadeMatrices[SHADOW_CASCADES];
+#if NR_POINT_LIGHTS > 0
+// six 90 degree faces per light, +x -x +y -y +z -z
+uniform sampler2DArrayShadow pointShadowMap;
+uniform mat4 pointShadowMatrices[SHADOW_POINT_LIGHTS * 6];
+#endif
+
+// fraction of the map's texels around 'coords' (xy and depth in [0, 1]) that are lit
+float ShadowTaps(sampler2DArrayShadow map, vec3 coords, float layer)
+{
+#if SHADOW_PCF_TAPS >= 4
+    vec2 texel = 0.5 / vec2(textureSize(map, 0).xy);
+    float lit = texture(map, vec4(coords.xy + vec2(-texel.x, -texel.y), layer, coords.z));
+    lit += texture(map, vec4(coords.xy + vec2(texel.x, -texel.y), layer, coords.z));
+    lit += texture(map, vec4(coords.xy + vec2(-texel.x, texel.y), layer, coords.z));
+    lit += texture(map, vec4(coords.xy + vec2(texel.x, texel.y), layer, coords.z));
+    return lit * 0.25;
+#else
+    return texture(map, vec4(coords.xy, layer, coords.z));
+#endif
+}
+
+// the finest cascade whose box holds the fragment; outside all of them it is lit. The map is sampled
+// unconditionally so the lookup stays in uniform control flow
+float DirectionalShadow(vec3 fragPos, vec3 normal)
+{
+    vec4 position = vec4(fragPos + normal * SHADOW_NORMAL_OFFSET, 1.0);
+    int cascade = SHADOW_CASCADES - 1;
+    vec3 coords = (cascadeMatrices[cascade] * position).xyz;
+    for (int i = SHADOW_CASCADES - 2; i >= 0; i--)
+    {
+        vec3 inner = (cascadeMatrices[i] * position).xyz;
+        if (all(greaterThan(inner, vec3(0.0))) && all(lessThan(inner, vec3(1.0))))
+        {
+            cascade = i;
+            coords = inner;
+        }
+    }
+    float lit = ShadowTaps(cascadeShadowMap, coords, float(cascade));
+    bool inside = all(greaterThan(coords, vec3(0.0))) && all(lessThan(coords, vec3(1.0)));
+    return inside ? lit : 1.0;
+}
+
+#if NR_POINT_LIGHTS > 0
+// the face a fragment falls on is the major axis of its direction from the light. Lights without maps
+// still take a lookup, which keeps it in uniform control flow, and ignore it
+float PointShadow(int light, vec3 lightPos, vec3 fragPos, vec3 normal)
+{
+    vec3 position = fragPos + normal * SHADOW_NORMAL_OFFSET;
+    vec3 direction = position - lightPos;
+    vec3 size = abs(direction);
+    int face;
+    if (size.x >= size.y && size.x >= size.z)
+        face = direction.x > 0.0 ? 0 : 1;
+    else if (size.y >= size.z)
+        face = direction.y > 0.0 ? 2 : 3;
+    else
+        face = direction.z > 0.0 ? 4 : 5;
+    int layer = min(light, SHADOW_POINT_LIGHTS - 1) * 6 + face;
+    vec4 clip = pointShadowMatrices[layer] * vec4(position, 1.0);
+    vec3 coords = clip.xyz / clip.w;
+    float lit = ShadowTaps(pointShadowMap, coords, float(layer));
+    // past the far plane of the faces nothing was rendered
+    return coords.z < 1.0 && light < SHADOW_POINT_LIGHTS ? lit : 1.0;
+}
+#endif
+#else
+float DirectionalShadow(vec3 fragPos, vec3 normal)
+{
+    return 1.0;
+}
+
+float PointShadow(int light, vec3 lightPos, vec3 fragPos, vec3 normal)
+{
+    return 1.0;
+}
+#endif
@@ -0,0 +1,255 @@
+#ifndef SHADOW_MAPS_H
+#define SHADOW_MAPS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "culling.h"
+#include "scene.h"
+#include "shader.h"
+
+#include <cmath>
+#include <vector>
+
+// one depth map: the light's matrices, its frustum for culling the casters and the texture layer it lives in
+struct ShadowView
+{
+	glm::mat4 projection;
+	glm::mat4 view;
+	glm::mat4 viewProjection;
+	// world space to the map's texture space: xy in [0, 1] and the depth to compare against
+	glm::mat4 lookup;
+	Frustum frustum;
+	GLsizei size;
+	unsigned int texture;
+	int layer;
+	bool dirty;
+};
+
+// Shadow maps of the directional light and the point lights, rendered only when they are out of date. The
+// pieces hardly ever move, so a map is drawn once and then read frame after frame; it is drawn again when its
+// light changes or when a moved instance (Scene::Moves) was or now is inside its frustum.
+//
+// The directional light has a cascade per box given to SetCascadeBounds, from the finest to the coarsest; each
+// cascade is an orthographic projection fit tightly around its box, so unlike view fitted cascades it doesn't
+// change when the camera moves. Every point light has six 90 degree faces. All maps are layers of two depth
+// array textures with hardware comparison, which the lit programs read through shadows.glsl.
+class ShadowMaps
+{
+public:
+	static const int MAX_CASCADES = 4;
+	static const int FACES = 6;
+	static const GLsizei CASCADE_SIZE = 2048;
+	static const GLsizei POINT_SIZE = 512;
+	static constexpr float POINT_NEAR = 0.05f;
+	static constexpr float POINT_FAR = 25.0f;
+	// depth bias of the caster passes, in polygon offset units
+	static constexpr float OFFSET_FACTOR = 2.0f;
+	static constexpr float OFFSET_UNITS = 4.0f;
+
+	ShadowMaps() : cascadeCount(0), pointLightCount(0), cascadeTexture(0), pointTexture(0), FBO(0), lightDirection(0.0f) {}
+
+	// creates the textures; call once the GL context is current
+	void Init(int cascades, int pointLights)
+	{
+		cascadeCount = cascades < MAX_CASCADES ? cascades : MAX_CASCADES;
+		pointLightCount = pointLights;
+		cascadeTexture = createArray(CASCADE_SIZE, cascadeCount);
+		pointTexture = createArray(POINT_SIZE, pointLightCount * FACES);
+		glGenFramebuffers(1, &FBO);
+		cascadeBounds.resize(cascadeCount);
+		pointPositions.resize(pointLightCount);
+		views.resize(cascadeCount + pointLightCount * FACES);
+		for (int i = 0; i < (int)views.size(); i++)
+		{
+			views[i].dirty = true;
+			views[i].size = i < cascadeCount ? CASCADE_SIZE : POINT_SIZE;
+			views[i].texture = i < cascadeCount ? cascadeTexture : pointTexture;
+			views[i].layer = i < cascadeCount ? i : i - cascadeCount;
+		}
+		lookups.resize(views.size());
+		// nothing is in shadow until the casters have been drawn
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		for (size_t i = 0; i < views.size(); i++)
+		{
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, views[i].texture, 0, views[i].layer);
+			glClear(GL_DEPTH_BUFFER_BIT);
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	int CascadeCount() const
+	{
+		return cascadeCount;
+	}
+
+	// the box cascade 'cascade' covers, in world space; everything that casts or receives its shadows must be inside
+	void SetCascadeBounds(int cascade, const AABB& bounds)
+	{
+		cascadeBounds[cascade] = bounds;
+		fitCascade(cascade);
+	}
+
+	// direction the light travels in; a new direction redraws every cascade
+	void SetDirectionalLight(const glm::vec3& direction)
+	{
+		if (direction == lightDirection)
+			return;
+		lightDirection = direction;
+		for (int i = 0; i < cascadeCount; i++)
+			fitCascade(i);
+	}
+
+	// a new position redraws the light's six faces
+	void SetPointLight(int light, const glm::vec3& position)
+	{
+		static const glm::vec3 axes[FACES] = {
+			glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+			glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+		};
+		static const glm::vec3 ups[FACES] = {
+			glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+			glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)
+		};
+		int first = cascadeCount + light * FACES;
+		if (!views[first].dirty && position == pointPositions[light])
+			return;
+		pointPositions[light] = position;
+		glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, POINT_NEAR, POINT_FAR);
+		for (int face = 0; face < FACES; face++)
+			setView(first + face, projection, glm::lookAt(position, position + axes[face], ups[face]));
+	}
+
+	// marks the maps the moved instances concern; call before Update with Scene::Moves(), then clear them
+	void InstancesMoved(const std::vector<SceneMove>& moves)
+	{
+		for (size_t i = 0; i < moves.size(); i++)
+			for (size_t v = 0; v < views.size(); v++)
+				if (!views[v].dirty && (views[v].frustum.IntersectsSphere(moves[i].from) || views[v].frustum.IntersectsSphere(moves[i].to)))
+					views[v].dirty = true;
+	}
+
+	// redraws every map on the next Update, e.g. after the caster programs were rebuilt
+	void Invalidate()
+	{
+		for (size_t i = 0; i < views.size(); i++)
+			views[i].dirty = true;
+	}
+
+	// redraws every out of date map: binds its layer, clears it and calls renderCasters(view), which draws the
+	// casters with the view's viewProjection. Returns the number of maps drawn; when it is not zero the
+	// framebuffer and viewport are left for the caller to restore
+	template <typename RenderCasters>
+	int Update(const RenderCasters &renderCasters)
+	{
+		int rendered = 0;
+		for (size_t i = 0; i < views.size(); i++)
+		{
+			ShadowView &view = views[i];
+			if (!view.dirty)
+				continue;
+			if (rendered == 0)
+			{
+				glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+				glEnable(GL_POLYGON_OFFSET_FILL);
+				glPolygonOffset(OFFSET_FACTOR, OFFSET_UNITS);
+			}
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, view.texture, 0, view.layer);
+			glViewport(0, 0, view.size, view.size);
+			glClear(GL_DEPTH_BUFFER_BIT);
+			renderCasters(view);
+			view.dirty = false;
+			rendered++;
+		}
+		if (rendered > 0)
+		{
+			glDisable(GL_POLYGON_OFFSET_FILL);
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		}
+		return rendered;
+	}
+
+	// binds the maps for shadows.glsl and sets its matrices; the program must be in use
+	void SetReceiverUniforms(Shader &shader, int cascadeUnit, int pointUnit) const
+	{
+		glActiveTexture(GL_TEXTURE0 + cascadeUnit);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, cascadeTexture);
+		glActiveTexture(GL_TEXTURE0 + pointUnit);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, pointTexture);
+		shader.setMat4Array("cascadeMatrices", &lookups[0], cascadeCount);
+		if (pointLightCount > 0)
+			shader.setMat4Array("pointShadowMatrices", &lookups[cascadeCount], pointLightCount * FACES);
+	}
+
+private:
+	static unsigned int createArray(GLsizei size, int layers)
+	{
+		unsigned int texture = 0;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, size, size, layers > 0 ? layers : 1, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		// linear filtering of a comparison gives 2x2 percentage-closer filtering for free
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		return texture;
+	}
+
+	// looks at the box along the light and wraps an orthographic projection around its eight corners
+	void fitCascade(int cascade)
+	{
+		if (lightDirection == glm::vec3(0.0f))
+			return;
+		const AABB &box = cascadeBounds[cascade];
+		glm::vec3 center = (box.min + box.max) * 0.5f;
+		float radius = glm::length(box.max - box.min) * 0.5f;
+		glm::vec3 direction = glm::normalize(lightDirection);
+		glm::vec3 up = std::fabs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		glm::mat4 view = glm::lookAt(center - direction * radius, center, up);
+		glm::vec3 low(0.0f), high(0.0f);
+		for (int corner = 0; corner < 8; corner++)
+		{
+			glm::vec3 point((corner & 1) ? box.max.x : box.min.x, (corner & 2) ? box.max.y : box.min.y, (corner & 4) ? box.max.z : box.min.z);
+			glm::vec3 light = glm::vec3(view * glm::vec4(point, 1.0f));
+			low = corner == 0 ? light : glm::min(low, light);
+			high = corner == 0 ? light : glm::max(high, light);
+		}
+		// the view looks down -z, so near and far are the negated z range
+		setView(cascade, glm::ortho(low.x, high.x, low.y, high.y, -high.z, -low.z), view);
+	}
+
+	void setView(int index, const glm::mat4 &projection, const glm::mat4 &view)
+	{
+		// clip space [-1, 1] to texture space [0, 1]
+		glm::mat4 bias(0.5f);
+		bias[3] = glm::vec4(0.5f, 0.5f, 0.5f, 1.0f);
+		ShadowView &shadowView = views[index];
+		shadowView.projection = projection;
+		shadowView.view = view;
+		shadowView.viewProjection = projection * view;
+		shadowView.lookup = bias * shadowView.viewProjection;
+		shadowView.frustum.Extract(shadowView.viewProjection);
+		shadowView.dirty = true;
+		lookups[index] = shadowView.lookup;
+	}
+
+	int cascadeCount;
+	int pointLightCount;
+	unsigned int cascadeTexture, pointTexture;
+	unsigned int FBO;
+	glm::vec3 lightDirection;
+	std::vector<AABB> cascadeBounds;
+	std::vector<glm::vec3> pointPositions;
+	// the cascades, then six faces per point light
+	std::vector<ShadowView> views;
+	std::vector<glm::mat4> lookups;
+};
+#endif
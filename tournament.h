@@ -0,0 +1,97 @@
+#ifndef TOURNAMENT_H
+#define TOURNAMENT_H
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+
+// the pieces of a set; parts of one piece (knight and knight head, rook and rook top, king and cross) share
+// an id so they are captured and moved together
+enum PieceKind {
+	PIECE_BISHOP,
+	PIECE_KNIGHT,
+	PIECE_ROOK,
+	PIECE_QUEEN,
+	PIECE_KING,
+	PIECE_PAWN
+};
+
+// Layout of a tournament: boards on a square grid centred on the origin.
+class TournamentGrid
+{
+public:
+	// the board is 2.76 units wide; leave a gap between neighbours
+	static constexpr float BOARD_SPACING = 3.2f;
+
+	TournamentGrid(unsigned int boardCount) : boardCount(boardCount)
+	{
+		columns = (unsigned int)std::ceil(std::sqrt((float)boardCount));
+		if (columns == 0)
+			columns = 1;
+	}
+
+	glm::vec3 BoardOffset(unsigned int board) const
+	{
+		if (boardCount <= 1)
+			return glm::vec3(0.0f);
+		float center = (columns - 1) * 0.5f;
+		return glm::vec3((board % columns - center) * BOARD_SPACING, 0.0f, (board / columns - center) * BOARD_SPACING);
+	}
+
+	// distance from the centre of the grid to its outer edge
+	float Extent() const
+	{
+		return columns * BOARD_SPACING * 0.5f;
+	}
+
+private:
+	unsigned int boardCount;
+	unsigned int columns;
+};
+
+// The game on one board of a tournament. Every board starts from the opening position and is advanced by a
+// pseudo random amount derived from its index, so the grid shows games at different stages and every run
+// shows the same ones: later games have more captured pieces and more advanced pawns.
+class TournamentGame
+{
+public:
+	// distance between two squares along a file
+	static constexpr float SQUARE_SIZE = 0.345f;
+
+	TournamentGame(unsigned int board) : board(board)
+	{
+		progress = random(0xFFFFu, 0, 0) * 0.7f;
+	}
+
+	// returns false when the piece has been captured; otherwise 'position' is where it stands now
+	bool Place(unsigned int side, PieceKind piece, unsigned int index, glm::vec3& position) const
+	{
+		unsigned int key = side * 8 + piece;
+		if (piece != PIECE_KING && random(key, index, 1) < progress * (piece == PIECE_PAWN ? 0.5f : 0.6f))
+			return false;
+		if (piece == PIECE_PAWN)
+		{
+			// black plays from +z, white from -z
+			int squares = (int)(random(key, index, 2) * (1.0f + progress * 2.0f));
+			position.z += (side == 0 ? -SQUARE_SIZE : SQUARE_SIZE) * squares;
+		}
+		return true;
+	}
+
+private:
+	// hash of the board and the arguments, in [0, 1)
+	float random(unsigned int a, unsigned int b, unsigned int c) const
+	{
+		unsigned int h = board * 0x9E3779B9u ^ a * 0x85EBCA6Bu ^ b * 0xC2B2AE35u ^ c * 0x27D4EB2Fu;
+		h ^= h >> 16;
+		h *= 0x7FEB352Du;
+		h ^= h >> 15;
+		h *= 0x846CA68Bu;
+		h ^= h >> 16;
+		return (h >> 8) * (1.0f / 16777216.0f);
+	}
+
+	unsigned int board;
+	float progress;
+};
+#endif
@@ -0,0 +1,54 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+
+// Lock-free handoff of the latest value from one producer thread to one consumer thread. The producer fills
+// its back slot and publishes it by swapping it with the middle slot; the consumer swaps the middle slot into
+// its front slot whenever a fresh one is waiting. Neither side ever waits for the other: the producer may
+// publish many times between two reads (only the newest survives) and the consumer may read the same value
+// many times. Publish once before the first Read().
+template <typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() : middle(1), back(0), front(2) {}
+
+	// producer: the slot to fill; it still holds whatever was written to it two publishes ago
+	T& Write()
+	{
+		return slots[back];
+	}
+
+	// producer: hands the filled slot to the consumer
+	void Publish()
+	{
+		back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+	}
+
+	// consumer: the most recently published value
+	const T& Read()
+	{
+		if (middle.load(std::memory_order_relaxed) & FRESH)
+			front = middle.exchange(front, std::memory_order_acq_rel) & INDEX_MASK;
+		return slots[front];
+	}
+
+	// consumer: true when a value newer than the last Read() is waiting
+	bool Fresh() const
+	{
+		return (middle.load(std::memory_order_relaxed) & FRESH) != 0;
+	}
+
+private:
+	static const unsigned int INDEX_MASK = 3;
+	static const unsigned int FRESH = 4;
+
+	T slots[3];
+	// index of the middle slot, plus FRESH when the producer published it after the consumer last looked;
+	// each side's index sits on its own cache line so the threads don't bounce a line between them
+	alignas(64) std::atomic<unsigned int> middle;
+	alignas(64) unsigned int back;
+	alignas(64) unsigned int front;
+};
+#endif